@@ -0,0 +1,123 @@
+/**
+ * Bounding volume hierarchy over the spheres of one frame
+ **/
+
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "bvh.h"
+
+static inline float centerCoord(const sphere *s, int axis) {
+  return axis == 0 ? s->pos.x : (axis == 1 ? s->pos.y : s->pos.z);
+}
+
+// fills the bounds of node from the spheres order[first, first + count)
+static void fitNode(bvhNode *node, const sphere *spheres, const int *order,
+                    int first, int count) {
+  for (int k = 0; k < 3; k++) {
+    node->lo[k] = node->centerLo[k] = FLT_MAX;
+    node->hi[k] = node->centerHi[k] = -FLT_MAX;
+  }
+
+  for (int i = first; i < first + count; i++) {
+    const sphere *s = &spheres[order[i]];
+    // pad the boxes so that rounding in the box test never drops a sphere
+    float pad = s->r * 1e-3f + 1e-3f;
+    for (int k = 0; k < 3; k++) {
+      float c = centerCoord(s, k);
+      node->lo[k] = fminf(node->lo[k], c - s->r - pad);
+      node->hi[k] = fmaxf(node->hi[k], c + s->r + pad);
+      node->centerLo[k] = fminf(node->centerLo[k], c);
+      node->centerHi[k] = fmaxf(node->centerHi[k], c);
+    }
+  }
+
+  node->first = first;
+  node->count = count;
+  node->left = -1;
+}
+
+// partially sorts order[lo, hi) so that the element at position k has its
+// final position along axis
+static void selectAxis(const sphere *spheres, int *order, int lo, int hi,
+                       int k, int axis) {
+  while (hi - lo > 1) {
+    float pivot = centerCoord(&spheres[order[(lo + hi) / 2]], axis);
+    int i = lo, j = hi - 1;
+    while (i <= j) {
+      while (centerCoord(&spheres[order[i]], axis) < pivot)
+        i++;
+      while (centerCoord(&spheres[order[j]], axis) > pivot)
+        j--;
+      if (i <= j) {
+        int tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+        i++;
+        j--;
+      }
+    }
+    if (k <= j)
+      hi = j + 1;
+    else if (k >= i)
+      lo = i;
+    else
+      return;
+  }
+}
+
+static void buildNode(bvh *b, const sphere *spheres, int index, int first,
+                      int count) {
+  bvhNode *node = &b->nodes[index];
+  fitNode(node, spheres, b->order, first, count);
+  if (count <= BVH_LEAF_SIZE)
+    return;
+
+  // split at the median center along the widest axis
+  int axis = 0;
+  for (int k = 1; k < 3; k++) {
+    if (node->centerHi[k] - node->centerLo[k] >
+        node->centerHi[axis] - node->centerLo[axis])
+      axis = k;
+  }
+  int half = count / 2;
+  selectAxis(spheres, b->order, first, first + count, first + half, axis);
+
+  int left = b->numNodes;
+  b->numNodes += 2;
+  node->left = left;
+  buildNode(b, spheres, left, first, half);
+  buildNode(b, spheres, left + 1, first + half, count - half);
+}
+
+void buildBVH(bvh *b, const sphere *spheres, int n) {
+  if (2 * n > b->capacity) {
+    free(b->nodes);
+    free(b->order);
+    b->capacity = 2 * n;
+    b->nodes = (bvhNode *)malloc(b->capacity * sizeof(bvhNode));
+    b->order = (int *)malloc(n * sizeof(int));
+    assert(b->nodes != NULL && b->order != NULL);
+  }
+
+  b->numNodes = 0;
+  if (n == 0)
+    return;
+
+  for (int i = 0; i < n; i++) {
+    b->order[i] = i;
+  }
+  b->numNodes = 1;
+  buildNode(b, spheres, 0, 0, n);
+}
+
+void freeBVH(bvh *b) {
+  free(b->nodes);
+  free(b->order);
+  b->nodes = NULL;
+  b->order = NULL;
+  b->capacity = 0;
+  b->numNodes = 0;
+}
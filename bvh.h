@@ -0,0 +1,70 @@
+/**
+ * Bounding volume hierarchy over the spheres of one frame
+ **/
+
+#ifndef BVH_H
+#define BVH_H
+
+#include "simulate.h"
+
+// Maximum number of spheres in a leaf
+#define BVH_LEAF_SIZE 4
+
+typedef struct {
+  float lo[3], hi[3];             // bounds of the spheres below this node
+  float centerLo[3], centerHi[3]; // bounds of their centers
+  int left;                       // children are left and left + 1, -1 if leaf
+  int first, count;               // leaf spheres are order[first, first+count)
+} bvhNode;
+
+// The tree does not depend on the camera, so one build serves every view of
+// a frame
+typedef struct {
+  int numNodes;
+  int capacity;
+  bvhNode *nodes;
+  int *order; // sphere indices, grouped by leaf
+} bvh;
+
+void buildBVH(bvh *b, const sphere *spheres, int n);
+
+void freeBVH(bvh *b);
+
+// returns the smallest distance from p to the box [lo, hi]
+static inline double boxDistance(const float *lo, const float *hi, vector p) {
+  double pc[3] = {p.x, p.y, p.z};
+  double sq = 0;
+  for (int k = 0; k < 3; k++) {
+    double d = 0;
+    if (pc[k] < lo[k])
+      d = lo[k] - pc[k];
+    else if (pc[k] > hi[k])
+      d = pc[k] - hi[k];
+    sq += d * d;
+  }
+  return sqrt(sq);
+}
+
+// returns 1 if the ray origin + t * dir enters the box for some t in
+// [0, tMax], where invDir holds 1 / dir per axis
+static inline int rayHitsBox(const float *lo, const float *hi,
+                             const float *origin, const float *invDir,
+                             float tMax) {
+  float tNear = 0, tFar = tMax;
+  for (int k = 0; k < 3; k++) {
+    float t1 = (lo[k] - origin[k]) * invDir[k];
+    float t2 = (hi[k] - origin[k]) * invDir[k];
+    if (t1 != t1 || t2 != t2) // origin on the slab with a parallel ray
+      continue;
+    if (t1 > t2) {
+      float tmp = t1;
+      t1 = t2;
+      t2 = tmp;
+    }
+    tNear = t1 > tNear ? t1 : tNear;
+    tFar = t2 < tFar ? t2 : tFar;
+  }
+  return tNear <= tFar;
+}
+
+#endif
@@ -0,0 +1,202 @@
+/**
+ * Checkpoints of a running simulation, written on a background thread
+ **/
+
+#include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "checkpoint.h"
+#include "memory.h"
+#include "scene.h"
+
+typedef struct {
+  const char *path;
+  int interval;
+  int due; // a checkpoint is owed; touched by the frame thread only
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  int busy; // snapshot handed to the writer and not yet written
+  int stopping;
+  int failed;
+
+  // state of the run at the last snapshot; its buffers are reused
+  context snapshot;
+  size_t sphereCapacity;
+  int lightCapacity;
+} checkpointer;
+
+static checkpointer *active;
+
+static volatile sig_atomic_t requested;
+
+static void requestCheckpoint(int sig) { requested = 1; }
+
+// writes the snapshot next to path and renames it over path, so that a
+// process killed mid-write leaves the last checkpoint intact
+// returns 0 on success, -1 on failure
+static int writeSnapshot(checkpointer *c) {
+  size_t len = strlen(c->path) + sizeof(".tmp");
+  char *tmp = (char *)malloc(len);
+  assert(tmp != NULL);
+  snprintf(tmp, len, "%s.tmp", c->path);
+  int status = saveScene(&c->snapshot, tmp);
+  if (status == 0 && rename(tmp, c->path) != 0) {
+    printf("Could not write %s.\n", c->path);
+    status = -1;
+  }
+  free(tmp);
+  return status;
+}
+
+static void *writerLoop(void *arg) {
+  checkpointer *c = (checkpointer *)arg;
+
+  pthread_mutex_lock(&c->lock);
+  for (;;) {
+    while (!c->busy && !c->stopping) {
+      pthread_cond_wait(&c->changed, &c->lock);
+    }
+    if (!c->busy) {
+      break; // stopping and nothing left to write
+    }
+    pthread_mutex_unlock(&c->lock);
+
+    int failed = writeSnapshot(c) != 0;
+
+    pthread_mutex_lock(&c->lock);
+    c->failed |= failed;
+    c->busy = 0;
+    pthread_cond_broadcast(&c->changed);
+  }
+  pthread_mutex_unlock(&c->lock);
+
+  return NULL;
+}
+
+// copies the state of ctx after frame into the snapshot of c
+static void takeSnapshot(checkpointer *c, const context *ctx, int frame) {
+  context *snap = &c->snapshot;
+  size_t numSpheres = 2 * (size_t)ctx->bodies;
+  if (numSpheres > c->sphereCapacity) {
+    bigFree(snap->spheres);
+    snap->spheres = (sphere *)bigAlloc(numSpheres * sizeof(sphere));
+    assert(snap->spheres != NULL);
+    c->sphereCapacity = numSpheres;
+  }
+  parallelCopy(snap->spheres, ctx->spheres, numSpheres * sizeof(sphere));
+
+  if (ctx->numSceneLights > c->lightCapacity) {
+    snap->lights =
+        (light *)realloc(snap->lights, ctx->numSceneLights * sizeof(light));
+    assert(snap->lights != NULL);
+    c->lightCapacity = ctx->numSceneLights;
+  }
+  memcpy(snap->lights, ctx->lights, ctx->numSceneLights * sizeof(light));
+
+  snap->G = ctx->G;
+  snap->bodies = ctx->bodies;
+  snap->numSpheres = ctx->numSpheres;
+  snap->frame = frame;
+  snap->e = ctx->e;
+  snap->viewDirection = ctx->viewDirection;
+  snap->w = ctx->w;
+  snap->u = ctx->u;
+  snap->v = ctx->v;
+  snap->numLights = ctx->numLights;
+  snap->numSceneLights = ctx->numSceneLights;
+}
+
+int parseCheckpointSpec(const char *spec, int *interval, const char **path) {
+  int value, consumed = 0;
+  if (sscanf(spec, "%d%n", &value, &consumed) != 1 || value < 0) {
+    return 0;
+  }
+  if (spec[consumed] == ':' && spec[consumed + 1] != '\0') {
+    *path = spec + consumed + 1;
+  } else if (spec[consumed] != '\0') {
+    return 0;
+  }
+  *interval = value;
+  return 1;
+}
+
+int checkpointStart(const char *path, int interval) {
+  assert(active == NULL && interval >= 0);
+
+  checkpointer *c = (checkpointer *)calloc(1, sizeof(checkpointer));
+  assert(c != NULL);
+  c->path = path;
+  c->interval = interval;
+  pthread_mutex_init(&c->lock, NULL);
+  pthread_cond_init(&c->changed, NULL);
+  if (pthread_create(&c->thread, NULL, writerLoop, c) != 0) {
+    printf("Could not start the checkpoint thread.\n");
+    free(c);
+    return -1;
+  }
+
+  requested = 0;
+  signal(SIGUSR1, requestCheckpoint);
+  active = c;
+  return 0;
+}
+
+void checkpointFrame(const context *ctx, int frame) {
+  checkpointer *c = active;
+  if (c == NULL) {
+    return;
+  }
+  if ((c->interval > 0 && frame % c->interval == 0) || requested) {
+    requested = 0;
+    c->due = 1;
+  }
+  if (!c->due) {
+    return;
+  }
+
+  pthread_mutex_lock(&c->lock);
+  int busy = c->busy;
+  pthread_mutex_unlock(&c->lock);
+  if (busy) {
+    return;
+  }
+
+  // the writer is idle, so the snapshot is the frame thread's until handed
+  // over
+  takeSnapshot(c, ctx, frame);
+  c->due = 0;
+
+  pthread_mutex_lock(&c->lock);
+  c->busy = 1;
+  pthread_cond_broadcast(&c->changed);
+  pthread_mutex_unlock(&c->lock);
+}
+
+int checkpointStop(void) {
+  checkpointer *c = active;
+  if (c == NULL) {
+    return 0;
+  }
+  signal(SIGUSR1, SIG_DFL);
+  active = NULL;
+
+  pthread_mutex_lock(&c->lock);
+  c->stopping = 1;
+  pthread_cond_broadcast(&c->changed);
+  pthread_mutex_unlock(&c->lock);
+  pthread_join(c->thread, NULL);
+
+  int failed = c->failed;
+  pthread_mutex_destroy(&c->lock);
+  pthread_cond_destroy(&c->changed);
+  bigFree(c->snapshot.spheres);
+  free(c->snapshot.lights);
+  free(c);
+  return failed ? -1 : 0;
+}
@@ -0,0 +1,32 @@
+/**
+ * Checkpoints of a running simulation, written on a background thread
+ **/
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "context.h"
+
+// parses "K[:PATH]", K >= 0 being the checkpoint interval in frames; without
+// a PATH, *path is left alone
+// returns 1 and sets *interval (and *path) on success, else 0
+int parseCheckpointSpec(const char *spec, int *interval, const char **path);
+
+// starts checkpointing the run to path, as a binary scene (see scene.h),
+// every interval frames and after any frame during which the process got
+// SIGUSR1; interval 0 checkpoints on SIGUSR1 only
+// returns 0 on success, -1 if the writer thread could not be started
+int checkpointStart(const char *path, int interval);
+
+// called once ctx has finished frame number frame (simulated and sorted):
+// if a checkpoint is due, snapshots the state of ctx and hands the snapshot
+// to the writer thread; one due while the last is still being written is
+// taken after a later frame rather than waiting for it
+// does nothing unless checkpointStart was called
+void checkpointFrame(const context *ctx, int frame);
+
+// waits for the checkpoint being written and stops checkpointing
+// returns 0 if every checkpoint was written, -1 if any failed
+int checkpointStop(void);
+
+#endif
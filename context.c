@@ -0,0 +1,62 @@
+/**
+ * State of one scene: simulation, camera, lights, image and renderer caches
+ **/
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "context.h"
+#include "memory.h"
+
+void freeScene(context *ctx) {
+  if (ctx->sceneMap != NULL) {
+    munmap(ctx->sceneMap, ctx->sceneMapBytes);
+  } else {
+    bigFree(ctx->spheres);
+  }
+  free(ctx->lights);
+  ctx->sceneMap = NULL;
+  ctx->sceneMapBytes = 0;
+  ctx->spheres = NULL;
+  ctx->lights = NULL;
+}
+
+void freeContext(context *ctx) {
+  renderReset(ctx);
+  freeScene(ctx);
+  framebufferFree(ctx->img);
+  free(ctx->sortKeys);
+  free(ctx->sortMoved);
+  memset(ctx, 0, sizeof(context));
+}
+
+size_t contextFootprint(long bodies, int height, int width, int numViews) {
+  size_t n = bodies > 0 ? (size_t)bodies : 0;
+  size_t pixels = (size_t)max(height, 0) * max(width, 0);
+  size_t image = pixels > 0 ? framebufferBytes(framebufferFormat, height, width)
+                            : 0;
+
+  size_t bytes = 2 * n * sizeof(sphere) + image;
+  // keys and scratch of sort(), constants of setupFrame()
+  bytes += n * (2 * (sizeof(float) + sizeof(int)) + sizeof(sphere));
+  bytes += n * sizeof(sphereSetup);
+
+  if (useRayCache) {
+    bytes += pixels * sizeof(vector);
+  }
+  if (incrementalRender) {
+    bytes += n * (sizeof(sphere) + sizeof(screenBounds)) + pixels;
+  }
+  if (useHitBuffer) {
+    bytes += n * sizeof(sphere) + pixels * (sizeof(int) + sizeof(float) +
+                                            sizeof(uint32_t));
+  }
+  if (numViews > 0) {
+    // tree nodes and leaf order, then per view its constants, keys, node
+    // keys and image
+    bytes += 2 * n * sizeof(bvhNode) + n * sizeof(int);
+    bytes += numViews * (n * (sizeof(sphereSetup) + 3 * sizeof(float)) + image);
+  }
+  return bytes;
+}
@@ -0,0 +1,69 @@
+/**
+ * State of one scene: simulation, camera, lights, image and renderer caches
+ **/
+
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <limits.h>
+
+#include "render.h"
+
+// Largest body count of a scene: sphere i is stepped into spheres[i + bodies],
+// so every index below 2 * bodies must fit an int. Byte counts and pixel
+// indices are size_t throughout, so this is the only limit on scene size.
+#define MAX_BODIES (INT_MAX / 2)
+
+struct context {
+  // bodies info: the first numSpheres spheres are rendered, and sphere i is
+  // stepped into spheres[i + bodies]
+  double G;
+  int bodies, numSpheres;
+  sphere *spheres;
+
+  // frames simulated before the scene was saved, 0 unless it was loaded from
+  // a checkpoint
+  int frame;
+
+  // binary scene file the spheres point into (see mapScene), or NULL when
+  // they come from bigAlloc
+  void *sceneMap;
+  size_t sceneMapBytes;
+
+  // viewpoint and direction
+  vector e, viewDirection;
+
+  // basis vectors
+  vector w, u, v;
+
+  // lights info: numLights of the numSceneLights lights are on
+  int numLights, numSceneLights;
+  light *lights;
+
+  // image array of height x width pixels, laid out as framebufferFormat;
+  // NULL when frames are rendered elsewhere
+  int height, width;
+  void *img;
+
+  // renderer state kept between frames
+  renderCache cache;
+
+  // scratch of sort(), kept between frames and grown to the most spheres
+  // sorted: a key and its merge buffer per sphere, and the spheres moved
+  void *sortKeys;
+  sphere *sortMoved;
+  size_t sortCapacity;
+};
+
+// releases the spheres and lights of ctx, keeping its image and caches
+void freeScene(context *ctx);
+
+// releases everything ctx owns and zeroes it
+void freeContext(context *ctx);
+
+// estimates the bytes a context takes once it holds a scene of bodies spheres
+// and renders height x width frames (no image if height is 0) from numViews
+// views (0 for render()) under the current render options
+size_t contextFootprint(long bodies, int height, int width, int numViews);
+
+#endif
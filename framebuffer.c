@@ -0,0 +1,76 @@
+/**
+ * Framebuffer pixel formats written by render()
+ **/
+
+#include <cilk/cilk.h>
+#include <string.h>
+
+#include "framebuffer.h"
+#include "memory.h"
+
+fbFormat framebufferFormat = FB_RGB_FLOAT;
+
+static const char *formatNames[FB_NUM_FORMATS] = {"float", "rgb8", "half",
+                                                  "planar"};
+
+size_t framebufferBytes(fbFormat format, int height, int width) {
+  size_t numPixels = (size_t)height * width;
+  switch (format) {
+  case FB_RGB8:
+    return 3 * numPixels * sizeof(uint8_t);
+  case FB_RGB_HALF:
+    return 3 * numPixels * sizeof(uint16_t);
+  case FB_RGB_FLOAT:
+  case FB_PLANAR_FLOAT:
+  default:
+    return 3 * numPixels * sizeof(float);
+  }
+}
+
+void *framebufferAlloc(fbFormat format, int height, int width) {
+  void *fb = bigAlloc(framebufferBytes(format, height, width));
+  if (fb == NULL)
+    return NULL;
+
+  // rows are zeroed in the same cilk_for shape as the render kernels, so
+  // that each row's pages sit near the worker likely to render it
+  int planes = format == FB_PLANAR_FLOAT ? 3 : 1;
+  size_t rowBytes = framebufferBytes(format, 1, width) / planes;
+  size_t planeBytes = rowBytes * height;
+  cilk_for (int y = 0; y < height; y++) {
+    for (int p = 0; p < planes; p++) {
+      memset((char *)fb + p * planeBytes + y * rowBytes, 0, rowBytes);
+    }
+  }
+  return fb;
+}
+
+void framebufferFree(void *fb) { bigFree(fb); }
+
+const char *framebufferFormatName(fbFormat format) {
+  return format < FB_NUM_FORMATS ? formatNames[format] : "unknown";
+}
+
+int parseFramebufferFormat(const char *name, fbFormat *format) {
+  for (int f = 0; f < FB_NUM_FORMATS; f++) {
+    if (strcmp(name, formatNames[f]) == 0) {
+      *format = (fbFormat)f;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void framebufferToFloat(const void *fb, fbFormat format, int height,
+                        int width, float *out) {
+  size_t numPixels = (size_t)height * width;
+
+  if (format == FB_RGB_FLOAT) {
+    memcpy(out, fb, 3 * numPixels * sizeof(float));
+    return;
+  }
+
+  cilk_for (size_t p = 0; p < numPixels; p++) {
+    loadPixel(fb, format, p, numPixels, &out[3 * p]);
+  }
+}
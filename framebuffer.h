@@ -0,0 +1,171 @@
+/**
+ * Framebuffer pixel formats written by render()
+ **/
+
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Storage layouts for an image of height * width RGB pixels
+typedef enum {
+  FB_RGB_FLOAT,    // interleaved, 3 floats per pixel
+  FB_RGB8,         // interleaved, 3 bytes per pixel, clamped at write time
+  FB_RGB_HALF,     // interleaved, 3 IEEE half floats per pixel
+  FB_PLANAR_FLOAT, // one plane of floats per channel: R, then G, then B
+  FB_NUM_FORMATS
+} fbFormat;
+
+// format render() writes in, set once before init()
+extern fbFormat framebufferFormat;
+
+size_t framebufferBytes(fbFormat format, int height, int width);
+
+// allocates a framebuffer under memoryPolicy (see memory.h), zeroed by rows
+// in parallel
+// returns NULL on failure
+void *framebufferAlloc(fbFormat format, int height, int width);
+
+// releases a framebuffer from framebufferAlloc; NULL is ignored
+void framebufferFree(void *fb);
+
+const char *framebufferFormatName(fbFormat format);
+
+// returns 1 and sets format if name is a known format name, else 0
+int parseFramebufferFormat(const char *name, fbFormat *format);
+
+// expands the framebuffer into interleaved RGB floats
+void framebufferToFloat(const void *fb, fbFormat format, int height,
+                        int width, float *out);
+
+// IEEE 754 binary16, rounded to nearest even
+static inline uint16_t floatToHalf(float f) {
+  union {
+    float f;
+    uint32_t u;
+  } in = {f};
+  uint32_t sign = (in.u >> 16) & 0x8000;
+  uint32_t absBits = in.u & 0x7fffffff;
+
+  if (absBits >= 0x7f800000) { // inf or nan
+    return sign | 0x7c00 | (absBits > 0x7f800000 ? 0x200 : 0);
+  }
+  if (absBits >= 0x477ff000) { // rounds to at least 65520
+    return sign | 0x7c00;
+  }
+  if (absBits < 0x38800000) { // subnormal or zero
+    union {
+      uint32_t u;
+      float f;
+    } magic = {0x3f000000}; // 0.5, shifts the mantissa into place
+    union {
+      float f;
+      uint32_t u;
+    } abs = {.u = absBits};
+    abs.f += magic.f;
+    return sign | (uint16_t)(abs.u - magic.u);
+  }
+
+  uint32_t odd = (absBits >> 13) & 1;
+  absBits += 0xc8000fff + odd; // rebias exponent and round
+  return sign | (uint16_t)(absBits >> 13);
+}
+
+static inline float halfToFloat(uint16_t h) {
+  union {
+    uint32_t u;
+    float f;
+  } out;
+  uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  uint32_t exponent = (h >> 10) & 0x1f;
+  uint32_t mantissa = h & 0x3ff;
+
+  if (exponent == 0x1f) {
+    out.u = sign | 0x7f800000 | (mantissa << 13);
+  } else if (exponent != 0) {
+    out.u = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  } else {
+    out.f = mantissa * (1.0f / 16777216.0f); // 2^-24
+    out.u |= sign;
+  }
+  return out.f;
+}
+
+// stores pixel p = x + y * width of an image with numPixels pixels
+static inline void storePixel(void *fb, fbFormat format, size_t p,
+                              size_t numPixels, const float *rgb) {
+  switch (format) {
+  case FB_RGB_FLOAT: {
+    float *dst = (float *)fb + 3 * p;
+    dst[0] = rgb[0];
+    dst[1] = rgb[1];
+    dst[2] = rgb[2];
+    break;
+  }
+  case FB_RGB8: {
+    uint8_t *dst = (uint8_t *)fb + 3 * p;
+    for (int c = 0; c < 3; c++) {
+      float clamped = rgb[c] < 0 ? 0 : (rgb[c] > 1 ? 1 : rgb[c]);
+      dst[c] = (uint8_t)(clamped * 255 + 0.5f);
+    }
+    break;
+  }
+  case FB_RGB_HALF: {
+    uint16_t *dst = (uint16_t *)fb + 3 * p;
+    dst[0] = floatToHalf(rgb[0]);
+    dst[1] = floatToHalf(rgb[1]);
+    dst[2] = floatToHalf(rgb[2]);
+    break;
+  }
+  case FB_PLANAR_FLOAT: {
+    float *dst = (float *)fb + p;
+    dst[0] = rgb[0];
+    dst[numPixels] = rgb[1];
+    dst[2 * numPixels] = rgb[2];
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+// loads pixel p = x + y * width of an image with numPixels pixels
+static inline void loadPixel(const void *fb, fbFormat format, size_t p,
+                             size_t numPixels, float *rgb) {
+  switch (format) {
+  case FB_RGB_FLOAT: {
+    const float *src = (const float *)fb + 3 * p;
+    rgb[0] = src[0];
+    rgb[1] = src[1];
+    rgb[2] = src[2];
+    break;
+  }
+  case FB_RGB8: {
+    const uint8_t *src = (const uint8_t *)fb + 3 * p;
+    rgb[0] = src[0] / 255.0f;
+    rgb[1] = src[1] / 255.0f;
+    rgb[2] = src[2] / 255.0f;
+    break;
+  }
+  case FB_RGB_HALF: {
+    const uint16_t *src = (const uint16_t *)fb + 3 * p;
+    rgb[0] = halfToFloat(src[0]);
+    rgb[1] = halfToFloat(src[1]);
+    rgb[2] = halfToFloat(src[2]);
+    break;
+  }
+  case FB_PLANAR_FLOAT: {
+    const float *src = (const float *)fb + p;
+    rgb[0] = src[0];
+    rgb[1] = src[numPixels];
+    rgb[2] = src[2 * numPixels];
+    break;
+  }
+  default:
+    rgb[0] = rgb[1] = rgb[2] = 0;
+    break;
+  }
+}
+
+#endif
@@ -0,0 +1,158 @@
+/**
+ * Frames interpolated between simulation keyframes
+ **/
+
+#include <assert.h>
+#include <cilk/cilk.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "context.h"
+#include "interpolate.h"
+#include "memory.h"
+#include "simulate.h"
+
+int parseInterpolationSpec(const char *spec, int *interval,
+                           interpMethod *method) {
+  int value, consumed = 0;
+  if (sscanf(spec, "%d%n", &value, &consumed) != 1 || value <= 0) {
+    return 0;
+  }
+  const char *name = spec + consumed;
+  if (*name == '\0' || strcmp(name, ":linear") == 0) {
+    *method = INTERP_LINEAR;
+  } else if (strcmp(name, ":hermite") == 0) {
+    *method = INTERP_HERMITE;
+  } else {
+    return 0;
+  }
+  *interval = value;
+  return 1;
+}
+
+const char *interpMethodName(interpMethod method) {
+  return method == INTERP_HERMITE ? "hermite" : "linear";
+}
+
+// whether the velocity of a body changed from s0 to s1, a step of dt apart,
+// by more than its acceleration accounts for, i.e. it took part in a
+// collision; without one, simulate() sets s1.vel to s0.vel + dt * s0.accel
+static inline int collided(const sphere *s0, const sphere *s1, float dt) {
+  vector change = qsubtract(s1->vel, s0->vel);
+  float kick = qsize(qsubtract(change, scale(dt, s0->accel)));
+  return kick > 0.5f * qsize(change) &&
+         kick > 1e-5f * (qsize(s0->vel) + qsize(s1->vel));
+}
+
+// position of the body going from s0 to s1 over a step of dt, a fraction t
+// of the way
+static inline vector interpolatePosition(const sphere *s0, const sphere *s1,
+                                         float t, float dt,
+                                         interpMethod method) {
+  if (method == INTERP_LINEAR || collided(s0, s1, dt)) {
+    return qadd(s0->pos, scale(t, qsubtract(s1->pos, s0->pos)));
+  }
+  // cubic Hermite basis, with the velocities scaled to tangents over the step
+  float t2 = t * t, t3 = t2 * t;
+  float h00 = 2 * t3 - 3 * t2 + 1, h10 = t3 - 2 * t2 + t;
+  float h01 = -2 * t3 + 3 * t2, h11 = t3 - t2;
+  return qadd(qadd(scale(h00, s0->pos), scale(h10 * dt, s0->vel)),
+              qadd(scale(h01, s1->pos), scale(h11 * dt, s1->vel)));
+}
+
+// fills out[0..n) with the spheres of s1, moved to where they were a
+// fraction t of the way from s0
+static void interpolateSpheres(sphere *out, const sphere *s0,
+                               const sphere *s1, int n, float t, float dt,
+                               interpMethod method) {
+  cilk_for (int i = 0; i < n; i++) {
+    out[i] = copySphere(s1[i]);
+    out[i].pos = interpolatePosition(&s0[i], &s1[i], t, dt, method);
+  }
+}
+
+// sorts s[0..n) by distance from e, as sort() does for a context; an
+// interpolated frame keeps the order of the keyframe before it, so this is
+// close to linear
+static void sortSpheres(sphere *s, int n, vector e) {
+  for (int i = 1; i < n; i++) {
+    sphere key = copySphere(s[i]);
+    int j = i - 1;
+    while (j >= 0 && qdist(s[j].pos, e) > qdist(key.pos, e)) {
+      s[j + 1] = copySphere(s[j]);
+      j = j - 1;
+    }
+    s[j + 1] = key;
+  }
+}
+
+void runInterpolated(context *ctx, int numFrames, int interval,
+                     interpMethod method, frameConsumer consume, void *arg) {
+  int n = ctx->numSpheres;
+  float dt = simulationStep(ctx);
+  sphere *prev = (sphere *)bigAlloc(n * sizeof(sphere));
+  sphere *frame = (sphere *)bigAlloc(n * sizeof(sphere));
+  assert(prev != NULL && frame != NULL);
+
+  // frames first .. first + interval - 1 lead up to the next keyframe
+  for (int first = 1; first <= numFrames; first += interval) {
+    parallelCopy(prev, ctx->spheres, n * sizeof(sphere));
+    simulate(ctx);
+
+    // the new keyframe is still in the order of prev
+    for (int j = 1; j < interval && first + j - 1 <= numFrames; j++) {
+      interpolateSpheres(frame, prev, ctx->spheres, n, (float)j / interval,
+                         dt, method);
+      sortSpheres(frame, n, ctx->e);
+      consume(first + j - 1, frame, n, arg);
+    }
+
+    sort(ctx);
+    if (first + interval - 1 <= numFrames) {
+      consume(first + interval - 1, ctx->spheres, n, arg);
+    }
+  }
+
+  bigFree(prev);
+  bigFree(frame);
+}
+
+void measureInterpolation(context *ctx, context *ref, int numFrames,
+                          int interval, interpMethod method,
+                          interpError *err) {
+  int n = ctx->bodies;
+  assert(ref->bodies == n);
+  float dt = simulationStep(ctx);
+  float refStep = dt / interval;
+  sphere *prev = (sphere *)bigAlloc(n * sizeof(sphere));
+  assert(prev != NULL);
+
+  double sum = 0, radii = 0;
+  err->maxError = 0;
+  for (int f = 0; f < numFrames; f++) {
+    int j = f % interval + 1;
+    if (j == 1) {
+      parallelCopy(prev, ctx->spheres, n * sizeof(sphere));
+      simulate(ctx);
+    }
+    doTimeStep(ref, refStep);
+
+    const sphere *next = ctx->spheres;
+    for (int i = 0; i < n; i++) {
+      vector pos = j == interval ? next[i].pos
+                                 : interpolatePosition(&prev[i], &next[i],
+                                                       (float)j / interval,
+                                                       dt, method);
+      double e = qdist(pos, ref->spheres[i].pos);
+      sum += e;
+      err->maxError = fmax(err->maxError, e);
+      radii += ref->spheres[i].r;
+    }
+  }
+
+  err->frames = numFrames;
+  err->meanError = numFrames > 0 ? sum / ((double)numFrames * n) : 0;
+  err->meanRadius = numFrames > 0 ? radii / ((double)numFrames * n) : 0;
+  bigFree(prev);
+}
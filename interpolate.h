@@ -0,0 +1,48 @@
+/**
+ * Frames interpolated between simulation keyframes
+ **/
+
+#ifndef INTERPOLATE_H
+#define INTERPOLATE_H
+
+#include "pipeline.h"
+
+typedef enum {
+  INTERP_LINEAR,  // straight from one keyframe position to the next
+  INTERP_HERMITE, // cubic through both positions, tangent to both velocities
+} interpMethod;
+
+// Positional error of interpolated frames against a reference simulated at
+// the rate frames are rendered
+typedef struct {
+  int frames;
+  double meanError; // over every sphere of every frame
+  double maxError;
+  double meanRadius; // for scale
+} interpError;
+
+// parses "K[:linear|hermite]", K > 0 being the number of frames rendered per
+// simulate(); the method defaults to linear
+// returns 1 and sets *interval and *method on success, else 0
+int parseInterpolationSpec(const char *spec, int *interval,
+                           interpMethod *method);
+
+const char *interpMethodName(interpMethod method);
+
+// renders frames 1 to numFrames of ctx while calling simulate() only every
+// interval frames: every interval-th frame is a keyframe, simulated and
+// sorted as usual, and the frames between two keyframes get sorted copies of
+// the spheres at positions interpolated between them; spheres that collided
+// on the way are interpolated linearly, since their velocities jump
+// hands every frame in order to consume
+void runInterpolated(context *ctx, int numFrames, int interval,
+                     interpMethod method, frameConsumer consume, void *arg);
+
+// measures the error of numFrames interpolated frames of ctx against ref, a
+// second copy of the same scene stepped by 1/interval of simulationStep()
+// every frame; both are advanced and neither is sorted, so that sphere i is
+// the same body in both
+void measureInterpolation(context *ctx, context *ref, int numFrames,
+                          int interval, interpMethod method, interpError *err);
+
+#endif
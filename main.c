@@ -11,9 +11,18 @@
 #include <time.h>
 #include <unistd.h> // For `getopt`
 
+#include "checkpoint.h"
+#include "context.h"
+#include "interpolate.h"
 #include "main.h"
+#include "memory.h"
+#include "output.h"
+#include "pipeline.h"
 #include "render.h"
+#include "scene.h"
+#include "server.h"
 #include "simulate.h"
+#include "stats.h"
 #include "utils/fasttime.h"
 #include "utils/helper.h"
 
@@ -23,6 +32,10 @@
 #include <GL/glut.h>
 #endif
 
+#ifndef GL_HALF_FLOAT
+#define GL_HALF_FLOAT 0x140B
+#endif
+
 const uint32_t TIER_TIMEOUT = 2000;
 const uint32_t TIMEOUT = 58000;
 const int START_SIZE = 512;
@@ -35,19 +48,14 @@ const int DEFAULT_LINEAR_TIERS = MAX_TIER;
 const unsigned DEFAULT_BLOWTHROUGHS = 2;
 
 const int DEFAULT_NUM_FRAMES = 10;
+const int DEFAULT_BANDS_IN_FLIGHT = 2;
+const char *BANDED_OUTPUT_FILE = "framesBanded.ppm";
+const int DEFAULT_OUTPUT_BUFFERS = 3;
+const float VIEW_SEPARATION = 20;
+const char *DEFAULT_CHECKPOINT_FILE = "checkpoint.scn";
 
-// viewpoint and direction
-vector e, viewDirection;
-
-// basis vectors
-vector w, u, v;
-
-// lights info
-int numLights = MAX_NUM_LIGHTS;
-light lights[MAX_NUM_LIGHTS];
-
-// image array
-float *img;
+// scene simulated and rendered by everything but the tiers and the batch
+static context scene;
 
 // counter for number of frames
 int currFrames = 0;
@@ -58,49 +66,88 @@ int numFrames = -1;
 // graphics flag
 int graphics = -1;
 
-void init(char *fileName, int height, int width) {
+// per idle call budget of progressive rendering in graphics mode, in ms
+int progressiveBudget = -1;
+
+// whether the frame shown in graphics mode has been fully traced
+static int frameDone = 1;
+// set when only the lights changed since the last frame
+static int lightsChanged = 0;
+
+// number of views rendered per frame
+int numViews = -1;
+
+// rows per band and number of bands in flight for banded rendering
+int bandRows = -1;
+int bandsInFlight = -1;
+
+// number of simulated frames queued for rendering when pipelined
+int pipelineDepth = -1;
+
+// headless output: flag, destination ("-" for stdout), format, and the writer
+// frames are rendered into when not banded
+int outputFrames = -1;
+const char *outputPath;
+outFormat outputFormat = OUT_PPM;
+asyncWriter *outputWriter;
+
+// batch of scenes run concurrently: flag and directory of scene files
+int batchRun = -1;
+const char *batchDir;
+
+// render daemon: flag and path of its UNIX socket
+int serverRun = -1;
+const char *socketPath;
+
+// checkpoints: interval in frames (0 for SIGUSR1 only) and file; and whether
+// the input file is a checkpoint to resume from
+int checkpointInterval = -1;
+const char *checkpointPath;
+int resumeRun = -1;
+
+// frames rendered per simulate(), the ones between keyframes interpolated
+int interpInterval = -1;
+interpMethod interpolation = INTERP_LINEAR;
+
+// per-frame timings (and counters of STATS=1 builds): flag and CSV file
+int statsRun = -1;
+const char *statsPath;
+
+int init(context *ctx, char *fileName, int height, int width) {
   FILE *fp = fopen(fileName, "r");
   if (fp == NULL) {
     printf("The file name you entered (%s) is invalid.\n", fileName);
-    return;
+    return -1;
   }
-  assert(fp != NULL);
-
-  img = (float *)malloc(3 * height * width * sizeof(float));
-
-  fscanf(fp, "%lf%d", &G, &bodies);
-  numSpheres = bodies;
-  spheres = (sphere *)malloc(2 * bodies * sizeof(sphere));
-
-  for (int i = 0; i < bodies; i++) {
-    fscanf(fp, "%f%f%f%f%f%f%f%f%f%f%f%f", (float *)&spheres[i].r,
-           (float *)&spheres[i].mass, (float *)&spheres[i].pos.x,
-           (float *)&spheres[i].pos.y, (float *)&spheres[i].pos.z,
-           (float *)&spheres[i].vel.x, (float *)&spheres[i].vel.y,
-           (float *)&spheres[i].vel.z, &spheres[i].mat.diffuse.red,
-           &spheres[i].mat.diffuse.green, &spheres[i].mat.diffuse.blue,
-           &spheres[i].mat.reflection);
+
+  // turn away scenes that cannot fit before allocating anything for them
+  double G;
+  long bodies;
+  if (sceneReadHeader(fileName, &G, &bodies) == 0) {
+    size_t needed = contextFootprint(bodies, bandRows > 0 ? 0 : height, width,
+                                     useSceneTree ? 1 : max(numViews, 0));
+    size_t available = availableMemory();
+    if (available > 0 && needed > available) {
+      printf("The scene in %s needs about %zu MB, but only %zu MB are "
+             "available.\n",
+             fileName, needed >> 20, available >> 20);
+      fclose(fp);
+      return -1;
+    }
   }
 
-  for (int i = 0; i < bodies; i++) {
-    spheres[i + bodies] = copySphere(spheres[i]);
+  memset(ctx, 0, sizeof(context));
+  ctx->height = height;
+  ctx->width = width;
+  // banded rendering never holds the whole image
+  if (bandRows <= 0) {
+    ctx->img = framebufferAlloc(framebufferFormat, height, width);
   }
 
+  int status = isBinaryScene(fp) ? mapScene(ctx, fileName)
+                                 : loadScene(ctx, fp, fileName);
   fclose(fp);
-
-  // set the viewpoint and direction
-  e = newVector(800, 100, 0);
-  viewDirection = newVector(-1, 0, 0);
-
-  // calculate basis vectors
-  vector up = newVector(0, 0, 1);
-  w = scale(1 / qsize(viewDirection), viewDirection);
-  u = scale(1 / qsize(qcross(up, w)), qcross(up, w));
-  v = qcross(w, u);
-
-  lights[0] = newLight(newVector(0, 240, -100), newColor(1, 1, 1));
-  lights[1] = newLight(newVector(3200, 3000, -1000), newColor(0.6, 0.7, 1));
-  lights[2] = newLight(newVector(600, 0, -100), newColor(0.3, 0.5, 1));
+  return status;
 }
 
 void display(void) {
@@ -108,38 +155,144 @@ void display(void) {
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
   // Draw the pixel array
-  glDrawPixels(WIDTH, HEIGHT, GL_RGB, GL_FLOAT, img);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  switch (framebufferFormat) {
+  case FB_RGB8:
+    glDrawPixels(WIDTH, HEIGHT, GL_RGB, GL_UNSIGNED_BYTE, scene.img);
+    break;
+  case FB_RGB_HALF:
+    glDrawPixels(WIDTH, HEIGHT, GL_RGB, GL_HALF_FLOAT, scene.img);
+    break;
+  case FB_PLANAR_FLOAT:
+    // one pass per plane, each writing only its own channel
+    glColorMask(GL_TRUE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDrawPixels(WIDTH, HEIGHT, GL_RED, GL_FLOAT, scene.img);
+    glColorMask(GL_FALSE, GL_TRUE, GL_FALSE, GL_FALSE);
+    glDrawPixels(WIDTH, HEIGHT, GL_GREEN, GL_FLOAT,
+                 (float *)scene.img + WIDTH * HEIGHT);
+    glColorMask(GL_FALSE, GL_FALSE, GL_TRUE, GL_FALSE);
+    glDrawPixels(WIDTH, HEIGHT, GL_BLUE, GL_FLOAT,
+                 (float *)scene.img + 2 * WIDTH * HEIGHT);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    break;
+  default:
+    glDrawPixels(WIDTH, HEIGHT, GL_RGB, GL_FLOAT, scene.img);
+    break;
+  }
 
   // Reset buffer for next frame
   glutSwapBuffers();
 }
 
 void idle(void) {
-  if (currFrames++ > numFrames) {
-    exit(0);
+  // progressively rendered frames move on once fully traced; a light change
+  // alone keeps the spheres still, so a hit buffer reshades instead of tracing
+  if (frameDone && !lightsChanged) {
+    if (currFrames++ > numFrames) {
+      checkpointStop();
+      exit(0);
+    }
+
+    simulate(&scene);
+    sort(&scene);
+    checkpointFrame(&scene, currFrames);
+    progressiveRestart(&scene);
   }
+  lightsChanged = 0;
 
   glutPostRedisplay();
 
-  simulate();
-  sort(spheres, numSpheres, e);
-  render(img, HEIGHT, WIDTH, e, u, v, numLights, lights);
+  if (progressiveBudget > 0) {
+    frameDone = renderProgressive(&scene, scene.img, HEIGHT, WIDTH, scene.e,
+                                  scene.u, scene.v, scene.numLights,
+                                  scene.lights, progressiveBudget / 1e3);
+  } else {
+    render(&scene, scene.img, HEIGHT, WIDTH, scene.e, scene.u, scene.v,
+           scene.numLights, scene.lights);
+  }
+}
+
+// renders frame number frame of the spheres s[0..n) into img, or into a
+// buffer of the output writer
+static void renderFrame(int frame, sphere *s, int n) {
+  void *buf =
+      outputWriter != NULL ? asyncWriterAcquire(outputWriter) : scene.img;
+  renderSpheres(&scene, buf, HEIGHT, WIDTH, s, n, scene.e, scene.u, scene.v,
+                scene.numLights, scene.lights);
+  if (outputWriter != NULL) {
+    writeJob job = {frame, HEIGHT, WIDTH, 0, HEIGHT, framebufferFormat};
+    asyncWriterSubmit(outputWriter, buf, job);
+  }
+}
+
+// renders a snapshot handed over by the frame pipeline
+static void renderSnapshot(int frame, sphere *s, int n, void *arg) {
+  renderFrame(frame, s, n);
+}
+
+// runs the scene in fileName again with simulate() stepped every frame, by
+// 1/interpInterval of its step, and reports how much faster the interpolated
+// run took msec and how far its frames strayed from that reference
+// returns 0 on success, -1 if the scene could not be loaded
+static int reportInterpolation(FILE *report, char *fileName, uint32_t msec) {
+  context ref;
+  if (init(&ref, fileName, HEIGHT, WIDTH) != 0) {
+    return -1;
+  }
+  float refStep = simulationStep(&ref) / interpInterval;
+  fasttime_t start = gettime();
+  for (int f = 1; f <= numFrames; f++) {
+    doTimeStep(&ref, refStep);
+    sort(&ref);
+    render(&ref, ref.img, HEIGHT, WIDTH, ref.e, ref.u, ref.v, ref.numLights,
+           ref.lights);
+  }
+  uint32_t refTime = tdiff_msec(start, gettime());
+  freeContext(&ref);
+
+  // the error runs are untimed and unsorted, so spheres keep their indices
+  context interp;
+  interpError err;
+  if (init(&interp, fileName, HEIGHT, WIDTH) != 0) {
+    return -1;
+  }
+  if (init(&ref, fileName, HEIGHT, WIDTH) != 0) {
+    freeContext(&interp);
+    return -1;
+  }
+  measureInterpolation(&interp, &ref, numFrames, interpInterval,
+                       interpolation, &err);
+  freeContext(&interp);
+  freeContext(&ref);
+
+  fprintf(report,
+          "---- INTERPOLATION ----\n"
+          "Keyframes: every %d frames (%s), %d of %d frames simulated\n"
+          "Reference: every frame simulated, %u ms\n"
+          "Speedup: %.2fx\n"
+          "Position error: %.4g mean, %.4g max (mean radius %.4g)\n"
+          "---- END INTERPOLATION ----\n",
+          interpInterval, interpMethodName(interpolation),
+          (numFrames + interpInterval - 1) / interpInterval, numFrames, refTime,
+          (double)refTime / (msec > 0 ? msec : 1), err.meanError,
+          err.maxError, err.meanRadius);
+  return 0;
 }
 
 // Allows use of arrow keys to control movement
 void special(int key, int x, int y) {
   switch (key) {
   case GLUT_KEY_UP:
-    e = newVector(e.x, e.y, e.z + 1);
+    scene.e = newVector(scene.e.x, scene.e.y, scene.e.z + 1);
     break;
   case GLUT_KEY_DOWN:
-    e = newVector(e.x, e.y, e.z - 1);
+    scene.e = newVector(scene.e.x, scene.e.y, scene.e.z - 1);
     break;
   case GLUT_KEY_LEFT:
-    e = newVector(e.x, e.y + 1, e.z);
+    scene.e = newVector(scene.e.x, scene.e.y + 1, scene.e.z);
     break;
   case GLUT_KEY_RIGHT:
-    e = newVector(e.x, e.y - 1, e.z);
+    scene.e = newVector(scene.e.x, scene.e.y - 1, scene.e.z);
     break;
   }
 
@@ -152,7 +305,7 @@ void keyboard(unsigned char key, int x, int y) {
   case 'h':
     printf("HELP\n");
     printf("----\n");
-    printf("l - increase number of lights (max: 3)\n");
+    printf("l - increase number of lights (max: number from textfile)\n");
     printf("o - decrease number of lights (min: 1)\n");
     printf("s - increase number of spheres (max: number from textfile)\n");
     printf("d - decrease number of spheres (min: 1)\n");
@@ -165,44 +318,52 @@ void keyboard(unsigned char key, int x, int y) {
     printf("down arrow - move down\n");
     break;
   case 'l':
-    numLights += (numLights < 3) ? 1 : 0;
+    if (scene.numLights < scene.numSceneLights) {
+      scene.numLights++;
+      // reshade the cached hits on the next frame instead of simulating on;
+      // progressive frames pick the lights up as they are traced
+      lightsChanged = useHitBuffer && progressiveBudget <= 0;
+    }
     break;
   case 'o':
-    numLights -= (numLights > 1) ? 1 : 0;
+    if (scene.numLights > 1) {
+      scene.numLights--;
+      lightsChanged = useHitBuffer && progressiveBudget <= 0;
+    }
     break;
   case 's':
-    numSpheres += (numSpheres < bodies) ? 1 : 0;
+    scene.numSpheres += (scene.numSpheres < scene.bodies) ? 1 : 0;
     break;
   case 'd':
-    numSpheres -= (numSpheres > 1) ? 1 : 0;
+    scene.numSpheres -= (scene.numSpheres > 1) ? 1 : 0;
     break;
   case 'f':
-    e = newVector(e.x - 1, e.y, e.z);
+    scene.e = newVector(scene.e.x - 1, scene.e.y, scene.e.z);
     break;
   case 'b':
-    e = newVector(e.x + 1, e.y, e.z);
+    scene.e = newVector(scene.e.x + 1, scene.e.y, scene.e.z);
     break;
   case 'c':;
     float angle;
-    if (viewDirection.x != 0) {
-      angle = atan(viewDirection.y / viewDirection.x);
-    } else if (viewDirection.y < 0) {
+    if (scene.viewDirection.x != 0) {
+      angle = atan(scene.viewDirection.y / scene.viewDirection.x);
+    } else if (scene.viewDirection.y < 0) {
       angle = -3.14 / 2;
-    } else if (viewDirection.y > 0) {
+    } else if (scene.viewDirection.y > 0) {
       angle = 3.14 / 2;
     } else {
       break;
     }
-    if (viewDirection.x < 0) {
+    if (scene.viewDirection.x < 0) {
       angle = 3.14 + angle;
     }
-    viewDirection =
-        newVector(cos(angle + 0.1), sin(angle + 0.1), viewDirection.z);
+    scene.viewDirection =
+        newVector(cos(angle + 0.1), sin(angle + 0.1), scene.viewDirection.z);
     // calculate basis vectors
     vector up = newVector(0, 0, 1);
-    w = scale(1 / qsize(viewDirection), viewDirection);
-    u = scale(1 / qsize(qcross(up, w)), qcross(up, w));
-    v = qcross(w, u);
+    scene.w = scale(1 / qsize(scene.viewDirection), scene.viewDirection);
+    scene.u = scale(1 / qsize(qcross(up, scene.w)), qcross(up, scene.w));
+    scene.v = qcross(scene.w, scene.u);
     break;
   }
 
@@ -214,9 +375,12 @@ int main(int argc, char *argv[]) {
   int test_tiers = -1;
   int correctnessTool = -1;
   char *input_file = NULL;
+  pipelineStats pipeStats;
+  tierOptions tierOpts = {0, 1, 0, 0, NULL};
 
   // Parse the CLI input!
-  while ((opt = getopt(argc, argv, "hmgtf:n:")) != -1) {
+  while ((opt = getopt(argc, argv,
+                       "hmgtqciGLa:b:p:v:o:B:d:F:M:I:P:S:T:k:r:f:n:")) != -1) {
 
     switch (opt) {
     case 'h': // Help
@@ -243,6 +407,7 @@ int main(int argc, char *argv[]) {
       numFrames = atoi(optarg);
 
       SET_UNUSED_INT(test_tiers);
+      SET_UNUSED_INT(serverRun);
       break;
 
     case 'g':               // Flag that we want to use graphics
@@ -254,19 +419,85 @@ int main(int argc, char *argv[]) {
 
       SET_UNUSED_INT(correctnessTool);
       SET_UNUSED_INT(test_tiers);
+      SET_UNUSED_INT(bandRows);
+      SET_UNUSED_INT(numViews);
+      SET_UNUSED_INT(pipelineDepth);
+      SET_UNUSED_INT(outputFrames);
+      SET_UNUSED_INT(batchRun);
+      SET_UNUSED_INT(serverRun);
+      SET_UNUSED_INT(interpInterval);
+      SET_UNUSED_INT(statsRun);
       break;
 
     case 't':                 // Flag that we want to test
+    case 'T':                 // ...repeatably, without the global timeout
       if (test_tiers != -1) { // Also triggered by `UNUSED`
         goto help;
       }
 
+      if (opt == 'T') {
+        tierOpts.warmup = 1;
+        if (sscanf(optarg, "%d:%d", &tierOpts.repetitions, &tierOpts.warmup) <
+                1 ||
+            tierOpts.repetitions <= 0 || tierOpts.warmup < 0) {
+          goto help;
+        }
+        tierOpts.unattended = 1;
+      }
       test_tiers = 1;
 
       SET_UNUSED(input_file);
       SET_UNUSED_INT(numFrames);
       SET_UNUSED_INT(graphics);
       SET_UNUSED_INT(correctnessTool);
+      SET_UNUSED_INT(bandRows);
+      SET_UNUSED_INT(numViews);
+      SET_UNUSED_INT(pipelineDepth);
+      SET_UNUSED_INT(outputFrames);
+      SET_UNUSED_INT(batchRun);
+      SET_UNUSED_INT(serverRun);
+      SET_UNUSED_INT(checkpointInterval);
+      SET_UNUSED_INT(resumeRun);
+      SET_UNUSED_INT(interpInterval);
+      break;
+
+    case 'q': // Flag that we want the tiers searched by a cost model
+      tierOpts.modelSearch = 1;
+      break;
+
+    case 'c': // Flag that we want to reuse primary rays across frames
+      useRayCache = 1;
+      break;
+
+    case 'i': // Flag that we want to re-render only the pixels that changed
+      incrementalRender = 1;
+      break;
+
+    case 'G': // Flag that we want to reshade cached hits on light changes
+      useHitBuffer = 1;
+      break;
+
+    case 'L': // Flag that we want to find hits through a tree (large scenes)
+      useSceneTree = 1;
+      break;
+
+    case 'a': // Adaptive sampling with the given shading threshold
+      adaptiveThreshold = atof(optarg);
+      if (adaptiveThreshold < 0) {
+        goto help;
+      }
+      break;
+
+    case 'F': // Framebuffer format
+      if (!parseFramebufferFormat(optarg, &framebufferFormat)) {
+        goto help;
+      }
+      break;
+
+    case 'M': // Page size and NUMA placement of the image and spheres
+      if (!parseMemPolicy(optarg, &memoryPolicy)) {
+        goto help;
+      }
       break;
 
     case 'm':                      // Flag that we want to use correctness tool
@@ -278,13 +509,232 @@ int main(int argc, char *argv[]) {
 
       SET_UNUSED_INT(graphics);
       SET_UNUSED_INT(test_tiers);
+      SET_UNUSED_INT(bandRows);
+      SET_UNUSED_INT(numViews);
+      SET_UNUSED_INT(pipelineDepth);
+      SET_UNUSED_INT(outputFrames);
+      SET_UNUSED_INT(batchRun);
+      SET_UNUSED_INT(serverRun);
+      SET_UNUSED_INT(checkpointInterval);
+      SET_UNUSED_INT(resumeRun);
+      SET_UNUSED_INT(interpInterval);
+      SET_UNUSED_INT(statsRun);
+      break;
+
+    case 'v':               // Number of views rendered per frame
+      if (numViews != -1) { // Also triggered by `UNUSED`
+        goto help;
+      }
+
+      numViews = atoi(optarg);
+      if (numViews <= 0) {
+        goto help;
+      }
+
+      SET_UNUSED_INT(graphics);
+      SET_UNUSED_INT(correctnessTool);
+      SET_UNUSED_INT(test_tiers);
+      SET_UNUSED_INT(bandRows);
+      SET_UNUSED_INT(pipelineDepth);
+      SET_UNUSED_INT(outputFrames);
+      SET_UNUSED_INT(batchRun);
+      SET_UNUSED_INT(serverRun);
+      SET_UNUSED_INT(interpInterval);
+      SET_UNUSED_INT(statsRun);
+      break;
+
+    case 'p':                    // Pipelined simulation and rendering
+      if (pipelineDepth != -1) { // Also triggered by `UNUSED`
+        goto help;
+      }
+
+      pipelineDepth = atoi(optarg);
+      if (pipelineDepth <= 0) {
+        goto help;
+      }
+
+      SET_UNUSED_INT(graphics);
+      SET_UNUSED_INT(correctnessTool);
+      SET_UNUSED_INT(test_tiers);
+      SET_UNUSED_INT(bandRows);
+      SET_UNUSED_INT(numViews);
+      SET_UNUSED_INT(batchRun);
+      SET_UNUSED_INT(serverRun);
+      SET_UNUSED_INT(interpInterval);
+      SET_UNUSED_INT(statsRun);
+      break;
+
+    case 'b':               // Banded rendering to a file
+      if (bandRows != -1) { // Also triggered by `UNUSED`
+        goto help;
+      }
+
+      if (sscanf(optarg, "%d:%d", &bandRows, &bandsInFlight) < 1 ||
+          bandRows <= 0) {
+        goto help;
+      }
+
+      SET_UNUSED_INT(graphics);
+      SET_UNUSED_INT(correctnessTool);
+      SET_UNUSED_INT(test_tiers);
+      SET_UNUSED_INT(numViews);
+      SET_UNUSED_INT(pipelineDepth);
+      SET_UNUSED_INT(batchRun);
+      SET_UNUSED_INT(serverRun);
+      SET_UNUSED_INT(interpInterval);
+      SET_UNUSED_INT(statsRun);
+      break;
+
+    case 'o':                   // Headless output of every frame
+      if (outputFrames != -1) { // Also triggered by `UNUSED`
+        goto help;
+      }
+
+      if (!parseOutputSpec(optarg, &outputFormat, &outputPath)) {
+        goto help;
+      }
+      outputFrames = 1;
+
+      SET_UNUSED_INT(graphics);
+      SET_UNUSED_INT(correctnessTool);
+      SET_UNUSED_INT(test_tiers);
+      SET_UNUSED_INT(numViews);
+      SET_UNUSED_INT(batchRun);
+      SET_UNUSED_INT(serverRun);
+      break;
+
+    case 'B':               // Batch of scenes run concurrently
+      if (batchRun != -1) { // Also triggered by `UNUSED`
+        goto help;
+      }
+
+      batchDir = optarg;
+      batchRun = 1;
+
+      SET_UNUSED_INT(graphics);
+      SET_UNUSED_INT(correctnessTool);
+      SET_UNUSED_INT(test_tiers);
+      SET_UNUSED_INT(bandRows);
+      SET_UNUSED_INT(numViews);
+      SET_UNUSED_INT(pipelineDepth);
+      SET_UNUSED_INT(outputFrames);
+      SET_UNUSED_INT(serverRun);
+      SET_UNUSED_INT(checkpointInterval);
+      SET_UNUSED_INT(resumeRun);
+      SET_UNUSED_INT(interpInterval);
+      SET_UNUSED_INT(statsRun);
+      break;
+
+    case 'd':                // Render daemon on a UNIX socket
+      if (serverRun != -1) { // Also triggered by `UNUSED`
+        goto help;
+      }
+
+      socketPath = optarg;
+      serverRun = 1;
+
+      SET_UNUSED_INT(numFrames);
+      SET_UNUSED_INT(graphics);
+      SET_UNUSED_INT(correctnessTool);
+      SET_UNUSED_INT(test_tiers);
+      SET_UNUSED_INT(bandRows);
+      SET_UNUSED_INT(numViews);
+      SET_UNUSED_INT(pipelineDepth);
+      SET_UNUSED_INT(outputFrames);
+      SET_UNUSED_INT(batchRun);
+      SET_UNUSED_INT(checkpointInterval);
+      SET_UNUSED_INT(resumeRun);
+      SET_UNUSED_INT(interpInterval);
+      SET_UNUSED_INT(statsRun);
+      break;
+
+    case 'k':                         // Checkpoints of the run
+      if (checkpointInterval != -1) { // Also triggered by `UNUSED`
+        goto help;
+      }
+
+      checkpointPath = DEFAULT_CHECKPOINT_FILE;
+      if (!parseCheckpointSpec(optarg, &checkpointInterval, &checkpointPath)) {
+        goto help;
+      }
+
+      SET_UNUSED_INT(correctnessTool);
+      SET_UNUSED_INT(test_tiers);
+      SET_UNUSED_INT(batchRun);
+      SET_UNUSED_INT(serverRun);
+      SET_UNUSED_INT(interpInterval);
+      break;
+
+    case 'r': // Resumes the run saved in a checkpoint
+      // Also triggered by `UNUSED`
+      if (resumeRun != -1 || input_file != NULL) {
+        goto help;
+      }
+
+      input_file = optarg;
+      resumeRun = 1;
+
+      SET_UNUSED_INT(correctnessTool);
+      SET_UNUSED_INT(test_tiers);
+      SET_UNUSED_INT(batchRun);
+      SET_UNUSED_INT(serverRun);
+      SET_UNUSED_INT(interpInterval);
+      break;
+
+    case 'P': // Progressive rendering within a budget per idle call
+      progressiveBudget = atoi(optarg);
+      if (progressiveBudget <= 0) {
+        goto help;
+      }
+      break;
+
+    case 'S':             // Per-frame timings and counters as CSV
+      if (statsRun != -1) { // Also triggered by `UNUSED`
+        goto help;
+      }
+
+      statsPath = optarg;
+      statsRun = 1;
+
+      SET_UNUSED_INT(graphics);
+      SET_UNUSED_INT(correctnessTool);
+      SET_UNUSED_INT(bandRows);
+      SET_UNUSED_INT(numViews);
+      SET_UNUSED_INT(pipelineDepth);
+      SET_UNUSED_INT(batchRun);
+      SET_UNUSED_INT(serverRun);
+      SET_UNUSED_INT(interpInterval);
+      break;
+
+    case 'I':                     // Interpolated frames between simulations
+      if (interpInterval != -1) { // Also triggered by `UNUSED`
+        goto help;
+      }
+
+      if (!parseInterpolationSpec(optarg, &interpInterval, &interpolation)) {
+        goto help;
+      }
+
+      SET_UNUSED_INT(graphics);
+      SET_UNUSED_INT(correctnessTool);
+      SET_UNUSED_INT(test_tiers);
+      SET_UNUSED_INT(bandRows);
+      SET_UNUSED_INT(numViews);
+      SET_UNUSED_INT(pipelineDepth);
+      SET_UNUSED_INT(batchRun);
+      SET_UNUSED_INT(serverRun);
+      SET_UNUSED_INT(checkpointInterval);
+      SET_UNUSED_INT(resumeRun);
+      SET_UNUSED_INT(statsRun);
       break;
     }
   }
 
   // There should not be any extra arguments to be parsed,
-  // otherwise this likely is a malformed input
-  if (optind < argc) {
+  // otherwise this likely is a malformed input; Y4M planes span the whole
+  // frame, so they cannot be streamed band by band
+  if (optind < argc || (tierOpts.modelSearch && test_tiers <= 0) ||
+      (bandRows > 0 && outputFrames > 0 && outputFormat == OUT_Y4M)) {
     goto help;
   }
 
@@ -296,8 +746,27 @@ int main(int argc, char *argv[]) {
     numFrames = DEFAULT_NUM_FRAMES;
   }
 
-  if (test_tiers <= 0) {
-    init(input_file, HEIGHT, WIDTH);
+  // jobs bring their own scenes, frame counts and image sizes
+  if (serverRun > 0) {
+    return runServer(socketPath) == 0 ? 0 : 1;
+  }
+
+  // every scene of a batch gets its own context
+  if (batchRun > 0) {
+    return runBatch(batchDir, numFrames) == 0 ? 0 : 1;
+  }
+
+  if (test_tiers <= 0 && init(&scene, input_file, HEIGHT, WIDTH) != 0) {
+    return 1;
+  }
+
+  // a resumed run carries on counting from its checkpoint
+  if (resumeRun > 0) {
+    currFrames = scene.frame;
+  }
+  if (checkpointInterval >= 0 &&
+      checkpointStart(checkpointPath, checkpointInterval) != 0) {
+    return 1;
   }
 
   fasttime_t start = gettime();
@@ -315,34 +784,148 @@ int main(int argc, char *argv[]) {
 
     glutMainLoop();
   } else if (correctnessTool > 0) {
-    exportFramesRender(spheres, numSpheres, e, u, v, numLights, lights,
-                       numFrames);
-    exportFramesSimulate(spheres, numSpheres, e, u, v, numLights, lights,
-                         numFrames);
+    exportFramesRender(&scene, numFrames);
+    exportFramesSimulate(&scene, numFrames);
   } else if (test_tiers > 0) {
+    tierOpts.resultsPath = statsRun > 0 ? statsPath : NULL;
     uint32_t tier = run_tester_tiers(
         TIER_TIMEOUT, TIMEOUT, START_SIZE, GROWTH_RATE, DEFAULT_MIN_TIER,
-        DEFAULT_MAX_TIER, DEFAULT_LINEAR_TIERS, DEFAULT_BLOWTHROUGHS);
+        DEFAULT_MAX_TIER, DEFAULT_LINEAR_TIERS, DEFAULT_BLOWTHROUGHS,
+        &tierOpts);
 
     if (tier == -1) {
       printf(FAIL_STR ": too slow for any tiers\n");
     } else {
       printf("Result: reached tier %d\n", tier);
     }
-  } else {
+  } else if (bandRows > 0) {
+    if (bandsInFlight <= 0) {
+      bandsInFlight = DEFAULT_BANDS_IN_FLIGHT;
+    }
+    if (outputFrames <= 0) {
+      outputPath = BANDED_OUTPUT_FILE;
+    }
+    asyncWriter *writer = asyncWriterOpen(
+        outputPath, bandsInFlight,
+        framebufferBytes(framebufferFormat, bandRows, WIDTH),
+        outputEncoder(outputFormat));
+    if (writer == NULL) {
+      return 1;
+    }
+
     while (currFrames++ < numFrames) {
-      simulate();
-      sort(spheres, numSpheres, e);
-      render(img, HEIGHT, WIDTH, e, u, v, numLights, lights);
+      simulate(&scene);
+      sort(&scene);
+      checkpointFrame(&scene, currFrames);
+      renderBanded(writer, &scene, currFrames, HEIGHT, WIDTH, bandRows,
+                   outputBottomUp(outputFormat), scene.e, scene.u, scene.v,
+                   scene.numLights, scene.lights);
+    }
+
+    if (asyncWriterClose(writer) != 0) {
+      printf("Writing %s failed.\n", outputPath);
+    }
+  } else if (numViews > 1) {
+    // view 0 is rendered into img, the others into their own framebuffers
+    camera *cams = (camera *)malloc(numViews * sizeof(camera));
+    void **viewImgs = (void **)malloc(numViews * sizeof(void *));
+    viewImgs[0] = scene.img;
+    for (int k = 1; k < numViews; k++) {
+      viewImgs[k] = framebufferAlloc(framebufferFormat, HEIGHT, WIDTH);
+    }
+
+    while (currFrames++ < numFrames) {
+      simulate(&scene);
+      sort(&scene);
+      checkpointFrame(&scene, currFrames);
+      camera center = {scene.e, scene.u, scene.v};
+      cameraRig(center, VIEW_SEPARATION, numViews, cams);
+      renderViews(&scene, viewImgs, numViews, cams, HEIGHT, WIDTH,
+                  scene.numLights, scene.lights);
+    }
+
+    for (int k = 1; k < numViews; k++) {
+      framebufferFree(viewImgs[k]);
+    }
+    free(viewImgs);
+    free(cams);
+  } else {
+    if (outputFrames > 0) {
+      outputWriter = asyncWriterOpen(
+          outputPath, DEFAULT_OUTPUT_BUFFERS,
+          framebufferBytes(framebufferFormat, HEIGHT, WIDTH),
+          outputEncoder(outputFormat));
+      if (outputWriter == NULL) {
+        return 1;
+      }
+    }
+
+    if (pipelineDepth > 0) {
+      if (runPipeline(&scene, currFrames, numFrames, pipelineDepth,
+                      renderSnapshot, NULL, &pipeStats) != 0) {
+        return 1;
+      }
+    } else if (interpInterval > 0) {
+      runInterpolated(&scene, numFrames, interpInterval, interpolation,
+                      renderSnapshot, NULL);
+    } else {
+      FILE *statsFile = NULL;
+      if (statsRun > 0 && (statsFile = statsOpen(statsPath)) == NULL) {
+        return 1;
+      }
+      while (currFrames++ < numFrames) {
+        fasttime_t frameStart = gettime();
+        simulate(&scene);
+        fasttime_t simulated = gettime();
+        sort(&scene);
+        fasttime_t sorted = gettime();
+        checkpointFrame(&scene, currFrames);
+        // checkpointing is charged to no phase
+        fasttime_t renderStart = gettime();
+        renderFrame(currFrames, scene.spheres, scene.numSpheres);
+        if (statsFile != NULL) {
+          statsWriteFrame(statsFile, currFrames,
+                          tdiff_sec(frameStart, simulated) * 1e3,
+                          tdiff_sec(simulated, sorted) * 1e3,
+                          tdiff_sec(renderStart, gettime()) * 1e3);
+        }
+      }
+      if (statsFile != NULL && fclose(statsFile) != 0) {
+        printf("Writing %s failed.\n", statsPath);
+      }
+    }
+
+    if (outputWriter != NULL && asyncWriterClose(outputWriter) != 0) {
+      printf("Writing %s failed.\n", outputPath);
     }
   }
 
+  checkpointStop();
   fasttime_t stop = gettime();
   uint32_t time = tdiff_msec(start, stop);
   if (test_tiers <= 0) {
-    printf("Num spheres: %d\nImg size: %dx%d\nNum frames: %d\n---- RESULTS "
-           "----\nTime elapsed: %u ms\n---- END RESULTS ----\n",
-           bodies, HEIGHT, WIDTH, numFrames, time);
+    // keep frames streamed to stdout clean
+    FILE *report =
+        outputFrames > 0 && strcmp(outputPath, "-") == 0 ? stderr : stdout;
+    fprintf(report,
+            "Num spheres: %d\nImg size: %dx%d\nNum frames: %d\n---- RESULTS "
+            "----\nTime elapsed: %u ms\n---- END RESULTS ----\n",
+            scene.bodies, HEIGHT, WIDTH, numFrames, time);
+    if (incrementalRender || adaptiveThreshold >= 0 || useHitBuffer) {
+      fprintf(report, "Pixels traced: %lld of %lld\n",
+              scene.cache.totals.pixelsTraced, scene.cache.totals.pixelsTotal);
+    }
+    if (pipelineDepth > 0) {
+      fprintf(report,
+              "Frames per second: %.1f\nFrame latency: %.1f ms mean, %.1f ms "
+              "max\n",
+              pipeStats.frames / pipeStats.elapsed,
+              1e3 * pipeStats.meanLatency, 1e3 * pipeStats.maxLatency);
+    }
+    if (interpInterval > 0 &&
+        reportInterpolation(report, input_file, time) != 0) {
+      return 1;
+    }
   }
 
   // Success!
@@ -350,7 +933,14 @@ int main(int argc, char *argv[]) {
 
 help:
   printf(
-      "Usage: ./main [-f FILE_NAME] [-n NUM_FRAMES] [-m] [-g] [-t] [-h]\n"
+      "Usage: ./main [-f FILE_NAME] [-n NUM_FRAMES] [-m] [-g] [-t] [-c] "
+      "[-i] [-G] [-L]\n"
+      "              [-a THRESHOLD] [-F FORMAT] [-M POLICY] [-b ROWS[:BANDS]] "
+      "[-v VIEWS]\n"
+      "              [-p DEPTH] [-o [FORMAT:]PATH] [-k K[:PATH]] [-r FILE] "
+      "[-B DIR]\n"
+      "              [-d SOCKET] [-I K[:METHOD]] [-P MSEC] [-S PATH]\n"
+      "              [-T RUNS[:WARMUP]] [-q] [-h]\n"
       "\t"
       "-f file-name              \t Input file name                       \t "
       "Optional, may not be used with performance test flag\n"
@@ -365,7 +955,76 @@ help:
       "Optional, may not be used with performance or ref-tests flag\n"
       "\t"
       "-t                        \t Runs performance tests                \t "
-      "Optional, no other flags may be used\n"
+      "Optional, may only be used with render option flags or -S\n"
+      "\t"
+      "-T runs[:warmup]          \t Runs them repeatedly, without timeout \t "
+      "Optional, may only be used with render option flags or -S\n"
+      "\t"
+      "-q                        \t Predicts the last tier from a model   \t "
+      "Optional, may only be used with -t or -T\n"
+      "\t"
+      "-c                        \t Caches primary rays between frames    \t "
+      "Optional, may be used with any other flag\n"
+      "\t"
+      "-i                        \t Re-renders only pixels that changed   \t "
+      "Optional, may be used with any other flag\n"
+      "\t"
+      "-G                        \t Reshades cached hits on light changes \t "
+      "Optional, may be used with any other flag\n"
+      "\t"
+      "-L                        \t Finds hits through a tree (large N)   \t "
+      "Optional, may be used with any other flag\n"
+      "\t"
+      "-a threshold              \t Interpolates smooth blocks (adaptive) \t "
+      "Optional, may be used with any other flag\n"
+      "\t"
+      "-F float|rgb8|half|planar \t Framebuffer format (default: float)   \t "
+      "Optional, may be used with any other flag\n"
+      "\t"
+      "-M thp|huge[,interleave]  \t Huge pages and NUMA interleaving      \t "
+      "Optional, may be used with any other flag\n"
+      "\t"
+      "-b rows[:bands]           \t Renders in bands to framesBanded.ppm  \t "
+      "Optional, may not be used with performance, graphics or ref-tests "
+      "flag\n"
+      "\t"
+      "-v num-views              \t Renders a rig of views per frame      \t "
+      "Optional, may not be used with performance, graphics, ref-tests or "
+      "banded flag\n"
+      "\t"
+      "-p depth                  \t Simulates ahead of rendering (queue)  \t "
+      "Optional, may not be used with performance, graphics, ref-tests, "
+      "banded or views flag\n"
+      "\t"
+      "-o [ppm|pfm|y4m:]path     \t Writes every frame to path (- stdout) \t "
+      "Optional, may not be used with performance, graphics, ref-tests or "
+      "views flag, nor as y4m with the banded flag\n"
+      "\t"
+      "-k k[:path]               \t Checkpoints every k frames, on SIGUSR1\t "
+      "Optional, may not be used with performance, ref-tests, batch or "
+      "daemon flag\n"
+      "\t"
+      "-r file-name              \t Resumes the run checkpointed in file  \t "
+      "Optional, may not be used with -f or performance, ref-tests, batch "
+      "or daemon flag\n"
+      "\t"
+      "-I k[:linear|hermite]     \t Simulates every k frames, interpolates\t "
+      "Optional, may not be used with performance, graphics, ref-tests, "
+      "banded, views, pipelined or checkpoint flags\n"
+      "\t"
+      "-P msec                   \t Refines graphics frames progressively \t "
+      "Optional, only used with graphics flag\n"
+      "\t"
+      "-S path                   \t Writes frame timings and counters CSV \t "
+      "Optional, may not be used with graphics, ref-tests, banded, views, "
+      "pipelined or interpolated flags; with -t or -T, writes tier results "
+      "(JSON for *.json)\n"
+      "\t"
+      "-B directory              \t Runs every scene file in directory    \t "
+      "Optional, may only be used with -n and render option flags\n"
+      "\t"
+      "-d socket                 \t Serves render jobs on a UNIX socket   \t "
+      "Optional, may only be used with render option flags\n"
       "\t"
       "-h                        \t This help message\n");
 
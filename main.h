@@ -5,6 +5,9 @@
 #ifndef MAIN_H
 #define MAIN_H
 
+#include <stdio.h>
+
+#include "context.h"
 #include "utils/helper.h"
 
 #define SET_UNUSED(v) (void)v;
@@ -20,19 +23,6 @@
 #define PASS_STR COLOR_GREEN "PASS" COLOR_DEFAULT
 #define FAIL_STR COLOR_RED "FAIL" COLOR_DEFAULT
 
-// viewpoint and direction
-extern vector e, viewDirection;
-
-// basis vectors
-extern vector w, u, v;
-
-// lights info
-extern int numLights;
-extern light lights[MAX_NUM_LIGHTS];
-
-// image array
-extern float *img;
-
 // counter for number of frames
 extern int currFrames;
 
@@ -42,11 +32,29 @@ extern int numFrames;
 // graphics flag
 extern int graphics;
 
-void init(char *fileName, int height, int width);
+// loads the text or binary scene in fileName into ctx, with a height x width
+// image unless the frames are rendered in bands
+// returns 0 on success, -1 if the file cannot be opened or is malformed
+int init(context *ctx, char *fileName, int height, int width);
+
+// simulates and renders nFrames frames of every scene file (*.txt) in dir,
+// running the scenes concurrently, and reports the scene throughput
+// returns 0 on success, -1 if dir cannot be read or holds no scenes
+int runBatch(const char *dir, int nFrames);
+
+// How run_tester_tiers runs each tier
+typedef struct {
+  int warmup;      // untimed runs before the timed ones
+  int repetitions; // timed runs; a tier passes if their median is in time
+  int unattended;  // no global timeout, for runs without anyone watching
+  int modelSearch; // jump to the last tier a cost model expects to pass
+  const char *resultsPath; // JSON (*.json) or CSV results per tier, or NULL
+} tierOptions;
 
 uint32_t run_tester_tiers(const uint32_t tier_timeout, const uint32_t timeout,
                           const int start_n, const double increasing_ratio_of_n,
                           const int start_tier, const int highest_tier,
-                          const int linear_tiers, unsigned blowthroughs);
+                          const int linear_tiers, unsigned blowthroughs,
+                          const tierOptions *opts);
 
 #endif
@@ -0,0 +1,244 @@
+/**
+ * Allocation of large buffers with huge pages and NUMA placement
+ **/
+
+#include <assert.h>
+#include <cilk/cilk.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "memory.h"
+
+#define HUGE_PAGE_BYTES ((size_t)2 << 20)
+#define CACHE_LINE_BYTES 64
+#define MPOL_INTERLEAVE 3 // from linux/mempolicy.h, spares a libnuma dependency
+
+memPolicy memoryPolicy = {PAGES_DEFAULT, 0};
+
+// Mapping returned by bigAlloc, kept apart from it so that the buffer starts
+// on a huge page and stays untouched until firstTouch
+typedef struct bigMapping {
+  void *base;
+  size_t mapBytes;
+  struct bigMapping *next;
+} bigMapping;
+
+// live mappings; buffers not in the list come from malloc
+static bigMapping *bigMappings = NULL;
+static pthread_mutex_t bigMappingsLock = PTHREAD_MUTEX_INITIALIZER;
+
+// rounds x up to a multiple of the power of two a
+static inline size_t roundUp(size_t x, size_t a) {
+  return (x + a - 1) & ~(a - 1);
+}
+
+int parseMemPolicy(const char *spec, memPolicy *policy) {
+  memPolicy p = {PAGES_DEFAULT, 0};
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%s", spec);
+  for (char *save, *word = strtok_r(buf, ",", &save); word != NULL;
+       word = strtok_r(NULL, ",", &save)) {
+    if (strcmp(word, "thp") == 0) {
+      p.pages = PAGES_TRANSPARENT;
+    } else if (strcmp(word, "huge") == 0) {
+      p.pages = PAGES_EXPLICIT;
+    } else if (strcmp(word, "interleave") == 0) {
+      p.interleave = 1;
+    } else if (strcmp(word, "default") != 0) {
+      return 0;
+    }
+  }
+  *policy = p;
+  return 1;
+}
+
+// bit mask of the online NUMA nodes, from sysfs; node 0 if unknown
+static unsigned long onlineNodes(void) {
+  unsigned long mask = 0;
+  FILE *fp = fopen("/sys/devices/system/node/online", "r");
+  if (fp != NULL) {
+    int lo, hi;
+    while (fscanf(fp, "%d", &lo) == 1) {
+      hi = lo;
+      if (fscanf(fp, "-%d", &hi) != 1)
+        hi = lo;
+      for (int n = lo; n <= hi && n < 8 * (int)sizeof(mask); n++) {
+        mask |= 1UL << n;
+      }
+      if (fgetc(fp) != ',')
+        break;
+    }
+    fclose(fp);
+  }
+  return mask ? mask : 1;
+}
+
+// maps bytes (a multiple of HUGE_PAGE_BYTES) under memoryPolicy, aligned to
+// HUGE_PAGE_BYTES
+// returns the mapping, or NULL
+static void *mapPages(size_t bytes) {
+  static int warned = 0;
+  void *p = MAP_FAILED;
+  if (memoryPolicy.pages == PAGES_EXPLICIT) {
+    p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p == MAP_FAILED && !warned) {
+      printf("No reserved huge pages, using transparent ones.\n");
+      warned = 1;
+    }
+  }
+  if (p == MAP_FAILED) {
+    // maps a huge page more and trims both ends, so that the huge pages line
+    // up with the mapping
+    size_t slack = HUGE_PAGE_BYTES;
+    char *raw = (char *)mmap(NULL, bytes + slack, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+      return NULL;
+    char *aligned = (char *)roundUp((uintptr_t)raw, HUGE_PAGE_BYTES);
+    size_t head = aligned - raw;
+    if (head > 0)
+      munmap(raw, head);
+    if (slack - head > 0)
+      munmap(aligned + bytes, slack - head);
+    p = aligned;
+    if (memoryPolicy.pages != PAGES_DEFAULT) {
+      madvise(p, bytes, MADV_HUGEPAGE);
+    }
+  }
+  return p;
+}
+
+void *bigAlloc(size_t bytes) {
+  static int warned = 0;
+
+  if (memoryPolicy.pages == PAGES_DEFAULT && !memoryPolicy.interleave) {
+    return aligned_alloc(CACHE_LINE_BYTES,
+                         roundUp(bytes ? bytes : 1, CACHE_LINE_BYTES));
+  }
+
+  bigMapping *m = (bigMapping *)malloc(sizeof(bigMapping));
+  if (m == NULL)
+    return NULL;
+  // whole huge pages, so that the mapping starts and ends on one
+  m->mapBytes = roundUp(bytes ? bytes : 1, HUGE_PAGE_BYTES);
+  m->base = mapPages(m->mapBytes);
+  if (m->base == NULL) {
+    free(m);
+    return NULL;
+  }
+  if (memoryPolicy.interleave) {
+    unsigned long nodes = onlineNodes();
+    // policies only apply to pages not yet faulted in, as here
+    if (syscall(SYS_mbind, m->base, m->mapBytes, MPOL_INTERLEAVE, &nodes,
+                8 * sizeof(nodes) + 1, 0) != 0 &&
+        !warned) {
+      printf("Could not interleave memory over NUMA nodes.\n");
+      warned = 1;
+    }
+  }
+
+  pthread_mutex_lock(&bigMappingsLock);
+  m->next = bigMappings;
+  bigMappings = m;
+  pthread_mutex_unlock(&bigMappingsLock);
+  return m->base;
+}
+
+void bigFree(void *p) {
+  if (p == NULL)
+    return;
+  bigMapping *m = NULL;
+  pthread_mutex_lock(&bigMappingsLock);
+  for (bigMapping **link = &bigMappings; *link != NULL;
+       link = &(*link)->next) {
+    if ((*link)->base == p) {
+      m = *link;
+      *link = m->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&bigMappingsLock);
+
+  if (m != NULL) {
+    munmap(m->base, m->mapBytes);
+    free(m);
+  } else {
+    free(p);
+  }
+}
+
+void firstTouch(void *p, size_t bytes) {
+  char *c = (char *)p;
+  size_t chunks = (bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES;
+  cilk_for (size_t k = 0; k < chunks; k++) {
+    size_t start = k * HUGE_PAGE_BYTES;
+    size_t left = bytes - start;
+    memset(c + start, 0, left < HUGE_PAGE_BYTES ? left : HUGE_PAGE_BYTES);
+  }
+}
+
+void parallelCopy(void *dst, const void *src, size_t bytes) {
+  char *d = (char *)dst;
+  const char *s = (const char *)src;
+  size_t chunks = (bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES;
+  cilk_for (size_t k = 0; k < chunks; k++) {
+    size_t start = k * HUGE_PAGE_BYTES;
+    size_t left = bytes - start;
+    memcpy(d + start, s + start,
+           left < HUGE_PAGE_BYTES ? left : HUGE_PAGE_BYTES);
+  }
+}
+
+size_t availableMemory(void) {
+  FILE *fp = fopen("/proc/meminfo", "r");
+  if (fp != NULL) {
+    char line[128];
+    unsigned long long kb;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+      if (sscanf(line, "MemAvailable: %llu kB", &kb) == 1) {
+        fclose(fp);
+        return (size_t)kb << 10;
+      }
+    }
+    fclose(fp);
+  }
+  long pages = sysconf(_SC_AVPHYS_PAGES), pageBytes = sysconf(_SC_PAGESIZE);
+  return pages > 0 && pageBytes > 0 ? (size_t)pages * pageBytes : 0;
+}
+
+int resetPeakResident(void) {
+  // "5" resets VmHWM, since Linux 4.0
+  FILE *fp = fopen("/proc/self/clear_refs", "w");
+  if (fp == NULL) {
+    return 0;
+  }
+  int ok = fputs("5", fp) >= 0;
+  ok &= fclose(fp) == 0;
+  return ok;
+}
+
+size_t peakResident(void) {
+  FILE *fp = fopen("/proc/self/status", "r");
+  if (fp != NULL) {
+    char line[128];
+    unsigned long long kb;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+      if (sscanf(line, "VmHWM: %llu kB", &kb) == 1) {
+        fclose(fp);
+        return (size_t)kb << 10;
+      }
+    }
+    fclose(fp);
+  }
+  struct rusage usage;
+  return getrusage(RUSAGE_SELF, &usage) == 0 ? (size_t)usage.ru_maxrss << 10
+                                             : 0;
+}
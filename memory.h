@@ -0,0 +1,58 @@
+/**
+ * Allocation of large buffers with huge pages and NUMA placement
+ **/
+
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <stddef.h>
+
+// Page size of large buffers
+typedef enum {
+  PAGES_DEFAULT,     // whatever malloc hands out
+  PAGES_TRANSPARENT, // 2 MB aligned and advised for transparent huge pages
+  PAGES_EXPLICIT,    // MAP_HUGETLB from the reserved pool, else transparent
+} pageKind;
+
+typedef struct {
+  pageKind pages;
+  int interleave; // spread pages round robin over the NUMA nodes
+} memPolicy;
+
+// policy of every bigAlloc, set once before init()
+extern memPolicy memoryPolicy;
+
+// parses a comma separated list of "thp", "huge" and "interleave", or
+// "default"
+// returns 1 and sets policy on success, else 0
+int parseMemPolicy(const char *spec, memPolicy *policy);
+
+// allocates bytes under memoryPolicy, aligned to 64 bytes, and to 2 MB unless
+// the policy is the default; the memory is not touched, so that the caller
+// decides which worker faults each page in (see firstTouch)
+void *bigAlloc(size_t bytes);
+
+// releases memory from bigAlloc; NULL is ignored
+void bigFree(void *p);
+
+// zeroes p[0..bytes) in parallel, one page-sized chunk per iteration, so that
+// without interleaving each page lands on the node of the worker zeroing it
+void firstTouch(void *p, size_t bytes);
+
+// copies src[0..bytes) to dst in parallel, one page-sized chunk per iteration
+void parallelCopy(void *dst, const void *src, size_t bytes);
+
+// returns the bytes of memory the kernel reports as available for new
+// allocations without swapping, or 0 if it does not say
+size_t availableMemory(void);
+
+// resets the peak resident set size of the process to its current size,
+// where the kernel allows it
+// returns 1 if it was reset, else 0
+int resetPeakResident(void);
+
+// returns the peak resident set size of the process in bytes, since the last
+// resetPeakResident() that succeeded
+size_t peakResident(void);
+
+#endif
@@ -0,0 +1,300 @@
+/**
+ * Streaming frame output on a background writer thread
+ **/
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "output.h"
+
+#define SLOT_FREE 0
+#define SLOT_FULL 1
+
+typedef struct {
+  void *data;
+  int state;
+  writeJob job;
+} writerSlot;
+
+struct asyncWriter {
+  FILE *fp;
+  int closeFile;
+  encodeFunc encode;
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+
+  int numSlots;
+  writerSlot *slots;
+  long head; // next slot handed out by asyncWriterAcquire
+  long tail; // next slot written by the writer thread
+  int closing;
+
+  void *scratch;
+  size_t scratchBytes;
+};
+
+static void *writerLoop(void *arg) {
+  asyncWriter *w = (asyncWriter *)arg;
+
+  pthread_mutex_lock(&w->lock);
+  for (;;) {
+    writerSlot *slot = &w->slots[w->tail % w->numSlots];
+    while (slot->state != SLOT_FULL && !w->closing) {
+      pthread_cond_wait(&w->changed, &w->lock);
+    }
+    if (slot->state != SLOT_FULL) {
+      break; // closing and nothing left in flight
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    w->encode(w, w->fp, slot->data, &slot->job);
+
+    pthread_mutex_lock(&w->lock);
+    slot->state = SLOT_FREE;
+    w->tail++;
+    pthread_cond_broadcast(&w->changed);
+  }
+  pthread_mutex_unlock(&w->lock);
+
+  return NULL;
+}
+
+asyncWriter *asyncWriterOpen(const char *path, int numBuffers,
+                             size_t bufferBytes, encodeFunc encode) {
+  assert(numBuffers > 0);
+
+  asyncWriter *w = (asyncWriter *)calloc(1, sizeof(asyncWriter));
+  if (w == NULL)
+    return NULL;
+
+  if (strcmp(path, "-") == 0) {
+    w->fp = stdout;
+  } else {
+    w->fp = fopen(path, "wb");
+    w->closeFile = 1;
+  }
+  if (w->fp == NULL) {
+    printf("Could not open output file %s.\n", path);
+    free(w);
+    return NULL;
+  }
+
+  w->encode = encode;
+  w->numSlots = numBuffers;
+  w->slots = (writerSlot *)calloc(numBuffers, sizeof(writerSlot));
+  assert(w->slots != NULL);
+  for (int i = 0; i < numBuffers; i++) {
+    w->slots[i].data = malloc(bufferBytes);
+    assert(w->slots[i].data != NULL);
+  }
+
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->changed, NULL);
+  pthread_create(&w->thread, NULL, writerLoop, w);
+
+  return w;
+}
+
+void *asyncWriterAcquire(asyncWriter *w) {
+  writerSlot *slot = &w->slots[w->head % w->numSlots];
+
+  pthread_mutex_lock(&w->lock);
+  while (slot->state != SLOT_FREE) {
+    pthread_cond_wait(&w->changed, &w->lock);
+  }
+  pthread_mutex_unlock(&w->lock);
+
+  return slot->data;
+}
+
+void asyncWriterSubmit(asyncWriter *w, void *buf, writeJob job) {
+  writerSlot *slot = &w->slots[w->head % w->numSlots];
+  assert(slot->data == buf);
+
+  pthread_mutex_lock(&w->lock);
+  slot->job = job;
+  slot->state = SLOT_FULL;
+  w->head++;
+  pthread_cond_broadcast(&w->changed);
+  pthread_mutex_unlock(&w->lock);
+}
+
+void *asyncWriterScratch(asyncWriter *w, size_t bytes) {
+  if (bytes > w->scratchBytes) {
+    free(w->scratch);
+    w->scratch = malloc(bytes);
+    assert(w->scratch != NULL);
+    w->scratchBytes = bytes;
+  }
+  return w->scratch;
+}
+
+long asyncWriterJobsDone(asyncWriter *w) {
+  // only the writer thread advances tail
+  return w->tail;
+}
+
+int asyncWriterClose(asyncWriter *w) {
+  pthread_mutex_lock(&w->lock);
+  w->closing = 1;
+  pthread_cond_broadcast(&w->changed);
+  pthread_mutex_unlock(&w->lock);
+  pthread_join(w->thread, NULL);
+
+  int failed = fflush(w->fp) != 0 || ferror(w->fp);
+  if (w->closeFile && fclose(w->fp) != 0) {
+    failed = 1;
+  }
+
+  for (int i = 0; i < w->numSlots; i++) {
+    free(w->slots[i].data);
+  }
+  free(w->slots);
+  free(w->scratch);
+  pthread_mutex_destroy(&w->lock);
+  pthread_cond_destroy(&w->changed);
+  free(w);
+
+  return failed ? -1 : 0;
+}
+
+static inline uint8_t toByte(float c) {
+  float clamped = c < 0 ? 0 : (c > 1 ? 1 : c);
+  return (uint8_t)(clamped * 255 + 0.5f);
+}
+
+void encodePPM(asyncWriter *w, FILE *fp, const void *buf, const writeJob *job) {
+  // image rows are stored bottom-up, PPM is top-down
+  if (job->y1 == job->height) {
+    fprintf(fp, "P6\n%d %d\n255\n", job->width, job->height);
+  }
+
+  size_t numPixels = (size_t)(job->y1 - job->y0) * job->width;
+  uint8_t *row = (uint8_t *)asyncWriterScratch(w, 3 * (size_t)job->width);
+
+  for (int y = job->y1 - 1; y >= job->y0; y--) {
+    size_t first = (size_t)(y - job->y0) * job->width;
+    if (job->format == FB_RGB8) {
+      fwrite((const uint8_t *)buf + 3 * first, 3, job->width, fp);
+      continue;
+    }
+    for (int x = 0; x < job->width; x++) {
+      float rgb[3];
+      loadPixel(buf, job->format, first + x, numPixels, rgb);
+      row[3 * x + 0] = toByte(rgb[0]);
+      row[3 * x + 1] = toByte(rgb[1]);
+      row[3 * x + 2] = toByte(rgb[2]);
+    }
+    fwrite(row, 3, job->width, fp);
+  }
+}
+
+void encodePFM(asyncWriter *w, FILE *fp, const void *buf, const writeJob *job) {
+  // image rows are stored bottom-up, like PFM; a negative scale marks
+  // little-endian samples
+  if (job->y0 == 0) {
+    const uint16_t one = 1;
+    int littleEndian = *(const uint8_t *)&one;
+    fprintf(fp, "PF\n%d %d\n%s\n", job->width, job->height,
+            littleEndian ? "-1.0" : "1.0");
+  }
+
+  size_t numPixels = (size_t)(job->y1 - job->y0) * job->width;
+  if (job->format == FB_RGB_FLOAT) {
+    fwrite(buf, 3 * sizeof(float), numPixels, fp);
+    return;
+  }
+
+  float *row = (float *)asyncWriterScratch(w, 3 * sizeof(float) * job->width);
+  for (int y = job->y0; y < job->y1; y++) {
+    size_t first = (size_t)(y - job->y0) * job->width;
+    for (int x = 0; x < job->width; x++) {
+      loadPixel(buf, job->format, first + x, numPixels, &row[3 * x]);
+    }
+    fwrite(row, 3 * sizeof(float), job->width, fp);
+  }
+}
+
+void encodeY4M(asyncWriter *w, FILE *fp, const void *buf, const writeJob *job) {
+  if (asyncWriterJobsDone(w) == 0) {
+    fprintf(fp, "YUV4MPEG2 W%d H%d F30:1 Ip A1:1 C444\n", job->width,
+            job->height);
+  }
+
+  // jobs hold whole frames, since each plane spans the frame (see main.c)
+  size_t planeBytes = (size_t)job->height * job->width;
+  uint8_t *planes = (uint8_t *)asyncWriterScratch(w, 3 * planeBytes);
+  size_t numPixels = (size_t)(job->y1 - job->y0) * job->width;
+
+  for (int y = job->y0; y < job->y1; y++) {
+    size_t first = (size_t)(y - job->y0) * job->width;
+    // Y4M is top-down
+    size_t out = (size_t)(job->height - 1 - y) * job->width;
+    for (int x = 0; x < job->width; x++) {
+      float rgb[3];
+      loadPixel(buf, job->format, first + x, numPixels, rgb);
+      float r = rgb[0] < 0 ? 0 : (rgb[0] > 1 ? 1 : rgb[0]);
+      float g = rgb[1] < 0 ? 0 : (rgb[1] > 1 ? 1 : rgb[1]);
+      float b = rgb[2] < 0 ? 0 : (rgb[2] > 1 ? 1 : rgb[2]);
+      // BT.601, studio range
+      float luma = 0.299f * r + 0.587f * g + 0.114f * b;
+      planes[out + x] = (uint8_t)(16 + 219 * luma + 0.5f);
+      planes[planeBytes + out + x] =
+          (uint8_t)(128 + 224 * (b - luma) / 1.772f + 0.5f);
+      planes[2 * planeBytes + out + x] =
+          (uint8_t)(128 + 224 * (r - luma) / 1.402f + 0.5f);
+    }
+  }
+
+  fputs("FRAME\n", fp);
+  fwrite(planes, 1, 3 * planeBytes, fp);
+}
+
+static const char *outputNames[OUT_NUM_FORMATS] = {"ppm", "pfm", "y4m"};
+static const encodeFunc outputEncoders[OUT_NUM_FORMATS] = {
+    encodePPM, encodePFM, encodeY4M};
+
+int parseOutputSpec(const char *spec, outFormat *format, const char **path) {
+  const char *colon = strchr(spec, ':');
+  const char *dot = strrchr(spec, '.');
+  *format = OUT_PPM;
+  *path = spec;
+
+  for (int f = 0; f < OUT_NUM_FORMATS; f++) {
+    size_t len = strlen(outputNames[f]);
+    if (colon != NULL && (size_t)(colon - spec) == len &&
+        strncmp(spec, outputNames[f], len) == 0) {
+      *format = (outFormat)f;
+      *path = colon + 1;
+      return **path != '\0';
+    }
+    if (dot != NULL && strcmp(dot + 1, outputNames[f]) == 0) {
+      *format = (outFormat)f;
+    }
+  }
+  return *spec != '\0';
+}
+
+encodeFunc outputEncoder(outFormat format) { return outputEncoders[format]; }
+
+int outputBottomUp(outFormat format) { return format == OUT_PFM; }
+
+void renderBanded(asyncWriter *w, context *ctx, int frame, int height,
+                  int width, int bandRows, int bottomUp, vector e, vector u,
+                  vector v, int numLights, light *lights) {
+  for (int k = 0; k < height; k += bandRows) {
+    int y0 = bottomUp ? k : max(height - k - bandRows, 0);
+    int y1 = bottomUp ? min(k + bandRows, height) : height - k;
+    void *band = asyncWriterAcquire(w);
+    renderBand(ctx, band, height, width, y0, y1, e, u, v, numLights,
+               lights);
+
+    writeJob job = {frame, height, width, y0, y1, framebufferFormat};
+    asyncWriterSubmit(w, band, job);
+  }
+}
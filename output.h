@@ -0,0 +1,81 @@
+/**
+ * Streaming frame output on a background writer thread
+ **/
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdio.h>
+
+#include "render.h"
+
+// Describes the contents of one writer buffer
+typedef struct {
+  int frame;
+  int height, width; // size of the whole image
+  int y0, y1;        // rows [y0, y1) of the image held by the buffer
+  fbFormat format;
+} writeJob;
+
+typedef struct asyncWriter asyncWriter;
+
+// File formats frames can be written in
+typedef enum {
+  OUT_PPM, // binary PPM, one 8-bit image per frame
+  OUT_PFM, // little-endian PFM, one float image per frame
+  OUT_Y4M, // YUV4MPEG2 video stream, 8-bit 4:4:4 with BT.601 colors
+  OUT_NUM_FORMATS
+} outFormat;
+
+// Runs on the writer thread and writes the rows described by job to fp
+typedef void (*encodeFunc)(asyncWriter *w, FILE *fp, const void *buf,
+                           const writeJob *job);
+
+// opens path ("-" for stdout) with a pool of numBuffers buffers of
+// bufferBytes bytes each; returns NULL on failure
+asyncWriter *asyncWriterOpen(const char *path, int numBuffers,
+                             size_t bufferBytes, encodeFunc encode);
+
+// returns the next free buffer, waiting for the writer if all are in flight
+void *asyncWriterAcquire(asyncWriter *w);
+
+// hands buf, which must come from the last asyncWriterAcquire, to the writer
+void asyncWriterSubmit(asyncWriter *w, void *buf, writeJob job);
+
+// scratch memory owned by the writer thread, for use by encoders
+void *asyncWriterScratch(asyncWriter *w, size_t bytes);
+
+// number of jobs the writer thread has finished, for use by encoders
+long asyncWriterJobsDone(asyncWriter *w);
+
+// writes everything still in flight and closes the file
+// returns 0 on success, -1 if any write failed
+int asyncWriterClose(asyncWriter *w);
+
+// binary PPM, one image per frame, rows sent top band first
+void encodePPM(asyncWriter *w, FILE *fp, const void *buf, const writeJob *job);
+
+// PFM, one image per frame, rows sent bottom band first
+void encodePFM(asyncWriter *w, FILE *fp, const void *buf, const writeJob *job);
+
+// Y4M stream, one frame per frame; the planes span the frame, so every job
+// must hold a whole frame
+void encodeY4M(asyncWriter *w, FILE *fp, const void *buf, const writeJob *job);
+
+// parses "[FORMAT:]PATH", FORMAT being ppm, pfm or y4m; without one, the
+// format follows the extension of PATH and defaults to ppm
+// returns 1 and sets format and *path on success, else 0
+int parseOutputSpec(const char *spec, outFormat *format, const char **path);
+
+encodeFunc outputEncoder(outFormat format);
+
+// returns 1 if the encoder of format takes the bottom band of a frame first
+int outputBottomUp(outFormat format);
+
+// renders the current frame of ctx in bands of bandRows rows, top band first
+// unless bottomUp is set, and streams each band to w as soon as it is finished
+void renderBanded(asyncWriter *w, context *ctx, int frame, int height,
+                  int width, int bandRows, int bottomUp, vector e, vector u,
+                  vector v, int numLights, light *lights);
+
+#endif
@@ -0,0 +1,146 @@
+/**
+ * Frame pipeline overlapping the simulation of a frame with the rendering of
+ * the previous ones
+ **/
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "checkpoint.h"
+#include "context.h"
+#include "pipeline.h"
+#include "utils/fasttime.h"
+
+#define SLOT_FREE 0
+#define SLOT_FULL 1
+
+typedef struct {
+  int state;
+  int frame;
+  int numSpheres;
+  sphere *spheres;
+  fasttime_t start;     // when simulate() of this frame began
+  double checkpointSec; // spent in checkpointFrame(), left out of latency
+} frameSlot;
+
+typedef struct {
+  context *ctx;
+  int firstFrame; // frames simulated before the pipeline started
+  int numFrames;  // frames run by the pipeline
+
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+
+  int numSlots;
+  frameSlot *slots;
+} framePipeline;
+
+static void *producerLoop(void *arg) {
+  framePipeline *p = (framePipeline *)arg;
+
+  for (int f = 0; f < p->numFrames; f++) {
+    frameSlot *slot = &p->slots[f % p->numSlots];
+    fasttime_t start = gettime();
+
+    // the simulation state is the producer's own, so this overlaps with the
+    // consumer working on earlier snapshots
+    simulate(p->ctx);
+    sort(p->ctx);
+    fasttime_t checkpointStart = gettime();
+    checkpointFrame(p->ctx, p->firstFrame + f + 1);
+    double checkpointSec = tdiff_sec(checkpointStart, gettime());
+
+    pthread_mutex_lock(&p->lock);
+    while (slot->state != SLOT_FREE) {
+      pthread_cond_wait(&p->changed, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    int numSpheres = p->ctx->numSpheres;
+    memcpy(slot->spheres, p->ctx->spheres, numSpheres * sizeof(sphere));
+    slot->numSpheres = numSpheres;
+    slot->frame = p->firstFrame + f + 1;
+    slot->start = start;
+    slot->checkpointSec = checkpointSec;
+
+    pthread_mutex_lock(&p->lock);
+    slot->state = SLOT_FULL;
+    pthread_cond_broadcast(&p->changed);
+    pthread_mutex_unlock(&p->lock);
+  }
+
+  return NULL;
+}
+
+int runPipeline(context *ctx, int firstFrame, int numFrames, int depth,
+                frameConsumer consume, void *arg, pipelineStats *stats) {
+  assert(depth > 0);
+
+  numFrames = max(numFrames - firstFrame, 0);
+  framePipeline p;
+  p.ctx = ctx;
+  p.firstFrame = firstFrame;
+  p.numFrames = numFrames;
+  p.numSlots = depth;
+  p.slots = (frameSlot *)calloc(depth, sizeof(frameSlot));
+  assert(p.slots != NULL);
+  for (int i = 0; i < depth; i++) {
+    p.slots[i].spheres = (sphere *)malloc(max(ctx->bodies, 1) * sizeof(sphere));
+    assert(p.slots[i].spheres != NULL);
+  }
+  pthread_mutex_init(&p.lock, NULL);
+  pthread_cond_init(&p.changed, NULL);
+
+  memset(stats, 0, sizeof(pipelineStats));
+  fasttime_t begin = gettime();
+
+  pthread_t producer;
+  int failed = pthread_create(&producer, NULL, producerLoop, &p) != 0;
+  if (failed) {
+    printf("Could not start the simulation thread.\n");
+    numFrames = 0;
+  }
+
+  for (int f = 0; f < numFrames; f++) {
+    frameSlot *slot = &p.slots[f % p.numSlots];
+
+    pthread_mutex_lock(&p.lock);
+    while (slot->state != SLOT_FULL) {
+      pthread_cond_wait(&p.changed, &p.lock);
+    }
+    pthread_mutex_unlock(&p.lock);
+
+    consume(slot->frame, slot->spheres, slot->numSpheres, arg);
+
+    double latency = tdiff_sec(slot->start, gettime()) - slot->checkpointSec;
+    stats->meanLatency += latency;
+    stats->maxLatency = max(stats->maxLatency, latency);
+    stats->frames++;
+
+    pthread_mutex_lock(&p.lock);
+    slot->state = SLOT_FREE;
+    pthread_cond_broadcast(&p.changed);
+    pthread_mutex_unlock(&p.lock);
+  }
+
+  if (!failed) {
+    pthread_join(producer, NULL);
+  }
+  stats->elapsed = tdiff_sec(begin, gettime());
+  if (stats->frames > 0) {
+    stats->meanLatency /= stats->frames;
+  }
+
+  for (int i = 0; i < depth; i++) {
+    free(p.slots[i].spheres);
+  }
+  free(p.slots);
+  pthread_mutex_destroy(&p.lock);
+  pthread_cond_destroy(&p.changed);
+
+  return failed ? -1 : 0;
+}
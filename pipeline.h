@@ -0,0 +1,35 @@
+/**
+ * Frame pipeline overlapping the simulation of a frame with the rendering of
+ * the previous ones
+ **/
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "render.h"
+
+// Renders (or otherwise consumes) frame number frame, whose sorted spheres
+// are s[0..n); runs on the calling thread of runPipeline
+typedef void (*frameConsumer)(int frame, sphere *s, int n, void *arg);
+
+// Timings of one runPipeline call, in seconds; the latency of a frame runs
+// from the start of its simulate() to the end of its consumer, less the time
+// spent checkpointing it
+typedef struct {
+  int frames;
+  double elapsed;
+  double meanLatency;
+  double maxLatency;
+} pipelineStats;
+
+// runs frames firstFrame + 1 to numFrames of simulate() and sort() of ctx on
+// a producer thread, which checkpoints them (see checkpointFrame) and
+// snapshots the spheres of every frame into a queue of depth slots, and hands
+// the snapshots in frame order to consume on the calling thread; the producer
+// runs at most depth frames ahead of the consumer, and only touches the
+// simulation state of ctx
+// returns 0 on success, -1 if the producer thread could not be started
+int runPipeline(context *ctx, int firstFrame, int numFrames, int depth,
+                frameConsumer consume, void *arg, pipelineStats *stats);
+
+#endif
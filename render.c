@@ -3,6 +3,7 @@
  **/
 
 #include <assert.h>
+#include <limits.h>
 #include <cilk/cilk.h>
 #include <math.h>
 #include <stdio.h>
@@ -10,8 +11,11 @@
 #include <string.h>
 #include <time.h>
 
+#include "context.h"
 #include "render.h"
 #include "simulate.h"
+#include "stats.h"
+#include "utils/fasttime.h"
 
 // (i, j) is point in image coordinates
 // origin is location of eye
@@ -58,14 +62,1247 @@ int rayToSphereIntersection(ray *r, sphere *s, float *t) {
   return 0;
 }
 
-void render(float *img, int height, int width, vector e, vector u, vector v,
-            int numLights, light *lights) {
-  // TODO: delete this call to renderOrig and write your own, optimized code!
-  renderOrig(img, height, width, e, u, v, numLights, lights);
+int useRayCache = 0;
+int incrementalRender = 0;
+float adaptiveThreshold = -1;
+int specializedKernels = 1;
+int useHitBuffer = 0;
+int clusteredLights = 1;
+int useSceneTree = 0;
+
+static void setupLights(frameSetup *fs, int numLights, light *lights) {
+  if (numLights > fs->lightCapacity) {
+    free(fs->lightConsts);
+    fs->lightCapacity = numLights;
+    size_t bytes = (size_t)numLights * sizeof(lightSetup);
+    bytes = (bytes + 63) / 64 * 64;
+    fs->lightConsts = (lightSetup *)aligned_alloc(64, bytes);
+    assert(fs->lightConsts != NULL);
+  }
+
+  fs->numLights = numLights;
+  for (int j = 0; j < numLights; j++) {
+    fs->lightConsts[j].pos = lights[j].pos;
+    fs->lightConsts[j].intensity = lights[j].intensity;
+    fs->lightConsts[j].rangeSq =
+        lights[j].range > 0 ? lights[j].range * lights[j].range : INFINITY;
+  }
 }
 
-void renderOrig(float *img, int height, int width, vector e, vector u, vector v,
+static void freeFrameSetup(frameSetup *fs) {
+  free(fs->sphereConsts);
+  free(fs->lightConsts);
+  memset(fs, 0, sizeof(frameSetup));
+}
+
+// precomputes the ray-invariant intersection terms for every sphere and
+// copies the lights into a compact aligned array
+void setupFrame(frameSetup *fs, sphere *spheres, int numSpheres, vector e,
                 int numLights, light *lights) {
+  if (numSpheres > fs->capacity) {
+    free(fs->sphereConsts);
+    fs->capacity = numSpheres;
+    size_t bytes = (size_t)numSpheres * sizeof(sphereSetup);
+    bytes = (bytes + 63) / 64 * 64;
+    fs->sphereConsts = (sphereSetup *)aligned_alloc(64, bytes);
+    assert(fs->sphereConsts != NULL);
+  }
+
+  fs->e = e;
+  fs->spheres = spheres;
+  fs->numSpheres = numSpheres;
+  fs->clusters = NULL;
+
+  cilk_for (int i = 0; i < numSpheres; i++) {
+    vector dist = qsubtract(e, spheres[i].pos);
+    fs->sphereConsts[i].dist = dist;
+    fs->sphereConsts[i].c = (float)((double)qdot(dist, dist) -
+                                    (double)(spheres[i].r * spheres[i].r));
+  }
+
+  setupLights(fs, numLights, lights);
+}
+
+// computes eyeToPixel(height, width, x, y, e, u, v).dir, given the v term
+// scale(-height / 2 + y, v) that is shared by the whole row y
+static inline vector primaryRay(int width, int x, vector rowTerm, vector e,
+                                vector u) {
+  float us = -width / 2 + (float)x;
+  vector dir = qsubtract(qadd(scale(us, u), rowTerm), e);
+  return scale(1 / qsize(dir), dir);
+}
+
+static inline vector primaryRowTerm(int height, int y, vector v) {
+  float vs = -height / 2 + (float)y;
+  return scale(vs, v);
+}
+
+// rebuilds the cached directions if the camera or resolution changed
+// returns 1 if the cache was rebuilt, else 0
+int updateRayCache(rayCache *rc, int height, int width, vector e, vector u,
+                   vector v) {
+  if (rc->valid && rc->height == height && rc->width == width &&
+      equals(rc->e, e) && equals(rc->u, u) && equals(rc->v, v)) {
+    return 0;
+  }
+
+  if (!rc->valid || (size_t)rc->height * rc->width != (size_t)height * width) {
+    free(rc->dirs);
+    rc->dirs = (vector *)malloc((size_t)height * width * sizeof(vector));
+    assert(rc->dirs != NULL);
+  }
+
+  cilk_for (int y = 0; y < height; y++) {
+    vector rowTerm = primaryRowTerm(height, y, v);
+    vector *dirs = &rc->dirs[(size_t)y * width];
+    for (int x = 0; x < width; x++) {
+      dirs[x] = primaryRay(width, x, rowTerm, e, u);
+    }
+  }
+
+  rc->e = e;
+  rc->u = u;
+  rc->v = v;
+  rc->height = height;
+  rc->width = width;
+  rc->valid = 1;
+  return 1;
+}
+
+void freeRayCache(rayCache *rc) {
+  free(rc->dirs);
+  rc->dirs = NULL;
+  rc->valid = 0;
+}
+
+// adds up the Lambert terms of the lights for a point p with unit normal n on
+// sphere s and writes the clamped color to rgb; the lights are the first
+// numLights ones, or those listed in lightIds if it is not NULL
+static inline __attribute__((always_inline)) void
+shadeLambert(const frameSetup *fs, const sphere *s, vector p, vector n,
+             int numLights, const int *lightIds, float *rgb) {
+  double red = 0;
+  double green = 0;
+  double blue = 0;
+  int shaded = 0;
+
+  for (int k = 0; k < numLights; k++) {
+    const lightSetup *l = &fs->lightConsts[lightIds ? lightIds[k] : k];
+    vector dist = qsubtract(l->pos, p);
+    if (qdot(n, dist) <= 0 || qdot(dist, dist) > l->rangeSq)
+      continue;
+    shaded++;
+
+    // calculate Lambert diffusion
+    float lambert = qdot(scale(1 / qsize(dist), dist), n);
+    red += (double)(l->intensity.red * s->mat.diffuse.red * lambert);
+    green += (double)(l->intensity.green * s->mat.diffuse.green * lambert);
+    blue += (double)(l->intensity.blue * s->mat.diffuse.blue * lambert);
+  }
+
+  STAT_ADD(STAT_LIGHTS_SHADED, shaded);
+  (void)shaded;
+
+  rgb[0] = min((float)red, 1.0);
+  rgb[1] = min((float)green, 1.0);
+  rgb[2] = min((float)blue, 1.0);
+}
+
+// shades the hit of the primary ray with direction dir on sphere currentSphere
+// at parameter t with the lights chosen as in shadeLambert, and sets *normal
+// (if not NULL) to the normal there
+// returns 1 if the hit was shaded, or 0 for background and degenerate hits,
+// which are black; always inlined so that a constant numLights unrolls the
+// light loop
+static inline __attribute__((always_inline)) int
+shadeHit(const frameSetup *fs, vector dir, int currentSphere, float t,
+         int numLights, const int *lightIds, float *rgb, vector *normal) {
+  if (currentSphere == -1)
+    goto black;
+
+  const sphere *s = &fs->spheres[currentSphere];
+  vector newOrigin = qadd(fs->e, scale(t, dir));
+
+  // normal for new vector at intersection point
+  vector n = qsubtract(newOrigin, s->pos);
+  float n_size = qsize(n);
+  if (n_size == 0)
+    goto black;
+  n = scale(1 / n_size, n);
+
+  shadeLambert(fs, s, newOrigin, n, numLights, lightIds, rgb);
+  if (normal)
+    *normal = n;
+  return 1;
+
+black:
+  rgb[0] = rgb[1] = rgb[2] = 0;
+  return 0;
+}
+
+// finds the first sphere in sorted order that the primary ray with direction
+// dir hits
+// returns its index and sets *t, or returns -1
+static inline __attribute__((always_inline)) int
+firstHit(const frameSetup *fs, vector dir, float *t) {
+  float a = qdot(dir, dir);
+
+  for (int i = 0; i < fs->numSpheres; i++) {
+    if (rayToSphereSetupIntersection(dir, a, &fs->sphereConsts[i], t)) {
+      STAT_ADD(STAT_RAY_TESTS, i + 1);
+      STAT_ADD(STAT_RAY_HITS, 1);
+      return i;
+    }
+  }
+  STAT_ADD(STAT_RAY_TESTS, fs->numSpheres);
+  return -1;
+}
+
+// traces the primary ray with direction dir and writes its color to rgb
+// returns the index of the sphere hit, or -1 for background
+static inline __attribute__((always_inline)) int
+tracePixelLights(const frameSetup *fs, vector dir, int numLights, float *rgb) {
+  float t = 20000.0Q; // approx. infinity
+  int currentSphere = firstHit(fs, dir, &t);
+  shadeHit(fs, dir, currentSphere, t, numLights, NULL, rgb, NULL);
+  return currentSphere;
+}
+
+static inline int tracePixel(const frameSetup *fs, vector dir, float *rgb) {
+  return tracePixelLights(fs, dir, fs->numLights, rgb);
+}
+
+// conservative pixel rectangle that contains every pixel whose primary ray
+// can hit sphere s, found by projecting the corners of its bounding box onto
+// the image plane spanned by u and v
+screenBounds sphereScreenBounds(const sphere *s, int height, int width,
+                                vector e, vector u, vector v) {
+  screenBounds full = {0, 0, width - 1, height - 1};
+  screenBounds empty = {0, 0, -1, -1};
+
+  double n[3] = {(double)u.y * v.z - (double)u.z * v.y,
+                 (double)u.z * v.x - (double)u.x * v.z,
+                 (double)u.x * v.y - (double)u.y * v.x};
+  double eDotN = e.x * n[0] + e.y * n[1] + e.z * n[2];
+  if (eDotN == 0)
+    return full;
+
+  double minUs = INFINITY, maxUs = -INFINITY;
+  double minVs = INFINITY, maxVs = -INFINITY;
+  int behind = 0;
+
+  for (int k = 0; k < 8; k++) {
+    double c[3] = {(double)s->pos.x + ((k & 1) ? s->r : -s->r),
+                   (double)s->pos.y + ((k & 2) ? s->r : -s->r),
+                   (double)s->pos.z + ((k & 4) ? s->r : -s->r)};
+    double d[3] = {c[0] - e.x, c[1] - e.y, c[2] - e.z};
+    double dDotN = d[0] * n[0] + d[1] * n[1] + d[2] * n[2];
+
+    // the corner is in front of the eye iff the ray towards it crosses the
+    // image plane at a positive parameter
+    double param = -eDotN / dDotN;
+    if (!(dDotN != 0 && param > 0)) {
+      behind++;
+      continue;
+    }
+
+    double p[3] = {e.x + param * d[0], e.y + param * d[1], e.z + param * d[2]};
+    double us = p[0] * u.x + p[1] * u.y + p[2] * u.z;
+    double vs = p[0] * v.x + p[1] * v.y + p[2] * v.z;
+    minUs = fmin(minUs, us);
+    maxUs = fmax(maxUs, us);
+    minVs = fmin(minVs, vs);
+    maxVs = fmax(maxVs, vs);
+  }
+
+  if (behind == 8)
+    return empty;
+  if (behind > 0)
+    return full;
+
+  // pixel x has us = -width / 2 + x; keep a margin for rounding
+  double minX = floor(minUs + width / 2) - 2;
+  double maxX = ceil(maxUs + width / 2) + 2;
+  double minY = floor(minVs + height / 2) - 2;
+  double maxY = ceil(maxVs + height / 2) + 2;
+  if (maxX < 0 || maxY < 0 || minX > width - 1 || minY > height - 1)
+    return empty;
+
+  screenBounds b = {(int)fmax(minX, 0), (int)fmax(minY, 0),
+                    (int)fmin(maxX, width - 1), (int)fmin(maxY, height - 1)};
+  return b;
+}
+
+static inline int sameSphere(const sphere *s1, const sphere *s2) {
+  return equals(s1->pos, s2->pos) && s1->r == s2->r &&
+         s1->mat.diffuse.red == s2->mat.diffuse.red &&
+         s1->mat.diffuse.green == s2->mat.diffuse.green &&
+         s1->mat.diffuse.blue == s2->mat.diffuse.blue;
+}
+
+static inline int sameLights(const dirtyState *ds, int numLights,
+                             light *lights) {
+  if (ds->numLights != numLights)
+    return 0;
+  for (int j = 0; j < numLights; j++) {
+    if (!equals(ds->lights[j].pos, lights[j].pos) ||
+        ds->lights[j].intensity.red != lights[j].intensity.red ||
+        ds->lights[j].intensity.green != lights[j].intensity.green ||
+        ds->lights[j].intensity.blue != lights[j].intensity.blue ||
+        ds->lights[j].range != lights[j].range)
+      return 0;
+  }
+  return 1;
+}
+
+static void markBounds(unsigned char *mask, int width, screenBounds b) {
+  for (int y = b.minY; y <= b.maxY; y++) {
+    memset(&mask[(size_t)y * width + b.minX], 1, b.maxX - b.minX + 1);
+  }
+}
+
+// records the frame just rendered, and marks in ds->mask every pixel that can
+// differ from it in the frame described by the arguments
+// returns the number of marked pixels, or -1 if the whole frame is dirty
+static long long updateDirtyState(dirtyState *ds, void *img, int height,
+                                  int width, const sphere *spheres,
+                                  int numSpheres, vector e, vector u, vector v,
+                                  int numLights, light *lights) {
+  int reuse = ds->valid && ds->img == img && ds->height == height &&
+              ds->width == width && equals(ds->e, e) && equals(ds->u, u) &&
+              equals(ds->v, v) && sameLights(ds, numLights, lights);
+
+  if (numSpheres > ds->capacity) {
+    ds->capacity = numSpheres;
+    ds->spheres = (sphere *)realloc(ds->spheres, numSpheres * sizeof(sphere));
+    ds->bounds = (screenBounds *)realloc(ds->bounds,
+                                         numSpheres * sizeof(screenBounds));
+    assert(ds->spheres != NULL && ds->bounds != NULL);
+  }
+  if (!ds->valid || (size_t)ds->height * ds->width != (size_t)height * width) {
+    free(ds->mask);
+    ds->mask = (unsigned char *)malloc((size_t)height * width);
+    assert(ds->mask != NULL);
+  }
+
+  long long dirty = -1;
+  if (reuse) {
+    memset(ds->mask, 0, (size_t)height * width);
+    int n = max(ds->numSpheres, numSpheres);
+    for (int i = 0; i < n; i++) {
+      if (i < ds->numSpheres && i < numSpheres &&
+          sameSphere(&ds->spheres[i], &spheres[i]))
+        continue;
+      if (i < ds->numSpheres)
+        markBounds(ds->mask, width, ds->bounds[i]);
+      if (i < numSpheres)
+        markBounds(ds->mask, width,
+                   sphereScreenBounds(&spheres[i], height, width, e, u, v));
+    }
+
+    dirty = 0;
+    for (size_t p = 0; p < (size_t)height * width; p++) {
+      dirty += ds->mask[p];
+    }
+  }
+
+  cilk_for (int i = 0; i < numSpheres; i++) {
+    ds->spheres[i] = spheres[i];
+    ds->bounds[i] = sphereScreenBounds(&spheres[i], height, width, e, u, v);
+  }
+  ds->numSpheres = numSpheres;
+  ds->img = img;
+  ds->height = height;
+  ds->width = width;
+  ds->e = e;
+  ds->u = u;
+  ds->v = v;
+  if (numLights > ds->lightCapacity) {
+    ds->lightCapacity = numLights;
+    ds->lights = (light *)realloc(ds->lights, numLights * sizeof(light));
+    assert(ds->lights != NULL);
+  }
+  ds->numLights = numLights;
+  memcpy(ds->lights, lights, numLights * sizeof(light));
+  ds->valid = 1;
+
+  return dirty;
+}
+
+static void freeDirtyState(dirtyState *ds) {
+  free(ds->lights);
+  free(ds->spheres);
+  free(ds->bounds);
+  free(ds->mask);
+  memset(ds, 0, sizeof(dirtyState));
+}
+
+// packs a unit normal into two 16-bit fixed-point coordinates of its
+// octahedral projection, which keeps the angular error below 1e-4
+static inline uint32_t encodeNormal(vector n) {
+  float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+  float px = n.x / l1, py = n.y / l1;
+  if (n.z < 0) {
+    float fx = 1 - fabsf(py), fy = 1 - fabsf(px);
+    px = px >= 0 ? fx : -fx;
+    py = py >= 0 ? fy : -fy;
+  }
+  int16_t qx = (int16_t)(px * 32767.0f + (px >= 0 ? 0.5f : -0.5f));
+  int16_t qy = (int16_t)(py * 32767.0f + (py >= 0 ? 0.5f : -0.5f));
+  return (uint32_t)(uint16_t)qx | (uint32_t)(uint16_t)qy << 16;
+}
+
+static inline vector decodeNormal(uint32_t q) {
+  float px = (int16_t)(q & 0xffff) / 32767.0f;
+  float py = (int16_t)(q >> 16) / 32767.0f;
+  float pz = 1 - fabsf(px) - fabsf(py);
+  if (pz < 0) {
+    float fx = 1 - fabsf(py), fy = 1 - fabsf(px);
+    px = px >= 0 ? fx : -fx;
+    py = py >= 0 ? fy : -fy;
+  }
+  vector n = newVector(px, py, pz);
+  return scale(1 / qsize(n), n);
+}
+
+// traces rows [y0, y1) of a height x width image with frame setup fs; buf
+// holds those rows only, dirs, mask and hb (all optional) cover the whole
+// image, and lc (optional) replaces the numLights lights of every pixel by
+// those binned for the sphere it hits
+static inline __attribute__((always_inline)) void
+renderRowsBody(const frameSetup *fs, void *buf, int height, int width, int y0,
+               int y1, const vector *dirs, const unsigned char *mask,
+               hitBuffer *hb, vector e, vector u, vector v, int numLights,
+               const lightClusters *lc) {
+  fbFormat format = framebufferFormat;
+  size_t numPixels = (size_t)(y1 - y0) * width;
+
+  cilk_for (int y = y0; y < y1; y++) {
+    vector rowTerm = primaryRowTerm(height, y, v);
+    size_t row = (size_t)y * width;
+    size_t bufRow = (size_t)(y - y0) * width;
+    for (int x = 0; x < width; x++) {
+      if (mask && !mask[row + x])
+        continue;
+      vector dir = dirs ? dirs[row + x] : primaryRay(width, x, rowTerm, e, u);
+      float t = 20000.0Q; // approx. infinity
+      int id = firstHit(fs, dir, &t);
+      int count = numLights;
+      const int *lightIds = NULL;
+      if (lc && id >= 0) {
+        count = lc->counts[id];
+        lightIds = &lc->ids[(size_t)id * lc->stride];
+      }
+      float rgb[3];
+      vector n;
+      int shaded = shadeHit(fs, dir, id, t, count, lightIds, rgb, &n);
+      if (hb) {
+        hb->ids[row + x] = shaded ? id : -1;
+        hb->ts[row + x] = t;
+        hb->normals[row + x] = shaded ? encodeNormal(n) : 0;
+      }
+      storePixel(buf, format, bufRow + x, numPixels, rgb);
+    }
+  }
+}
+
+typedef void (*rowsKernel)(const frameSetup *fs, void *buf, int height,
+                           int width, int y0, int y1, const vector *dirs,
+                           const unsigned char *mask, hitBuffer *hb, vector e,
+                           vector u, vector v);
+
+// instantiates renderRowsBody with the light count, image size and light
+// clusters fixed to the given expressions, which may be constants or the
+// runtime parameters
+#define ROWS_KERNEL(NAME, NUM_LIGHTS, KERNEL_HEIGHT, KERNEL_WIDTH, CLUSTERS)  \
+  static void NAME(const frameSetup *fs, void *buf, int height, int width,    \
+                   int y0, int y1, const vector *dirs,                        \
+                   const unsigned char *mask, hitBuffer *hb, vector e,        \
+                   vector u, vector v) {                                      \
+    (void)height;                                                             \
+    (void)width;                                                              \
+    renderRowsBody(fs, buf, KERNEL_HEIGHT, KERNEL_WIDTH, y0, y1, dirs, mask,  \
+                   hb, e, u, v, NUM_LIGHTS, CLUSTERS);                        \
+  }
+
+ROWS_KERNEL(renderRowsAny, fs->numLights, height, width, fs->clusters)
+ROWS_KERNEL(renderRows1, 1, height, width, NULL)
+ROWS_KERNEL(renderRows2, 2, height, width, NULL)
+ROWS_KERNEL(renderRows3, 3, height, width, NULL)
+ROWS_KERNEL(renderRowsAnyFixed, fs->numLights, HEIGHT, WIDTH, fs->clusters)
+ROWS_KERNEL(renderRows1Fixed, 1, HEIGHT, WIDTH, NULL)
+ROWS_KERNEL(renderRows2Fixed, 2, HEIGHT, WIDTH, NULL)
+ROWS_KERNEL(renderRows3Fixed, 3, HEIGHT, WIDTH, NULL)
+
+// kernels indexed by [default image size][light count], where light count 0
+// stands for any other count
+static const rowsKernel rowsKernels[2][MAX_NUM_LIGHTS + 1] = {
+    {renderRowsAny, renderRows1, renderRows2, renderRows3},
+    {renderRowsAnyFixed, renderRows1Fixed, renderRows2Fixed,
+     renderRows3Fixed}};
+
+// picks the kernel specialized for this light count and image size
+static rowsKernel selectRowsKernel(int numLights, int height, int width) {
+  if (!specializedKernels)
+    return renderRowsAny;
+  int fixedSize = height == HEIGHT && width == WIDTH;
+  int lightIndex =
+      (numLights >= 1 && numLights <= MAX_NUM_LIGHTS) ? numLights : 0;
+  return rowsKernels[fixedSize][lightIndex];
+}
+
+static void renderRows(const frameSetup *fs, void *buf, int height, int width,
+                       int y0, int y1, const vector *dirs,
+                       const unsigned char *mask, hitBuffer *hb, vector e,
+                       vector u, vector v) {
+  rowsKernel kernel = selectRowsKernel(fs->numLights, height, width);
+  kernel(fs, buf, height, width, y0, y1, dirs, mask, hb, e, u, v);
+}
+
+static inline vector pixelRay(const vector *dirs, int height, int width, int x,
+                              int y, vector e, vector u, vector v) {
+  if (dirs)
+    return dirs[(size_t)y * width + x];
+  return primaryRay(width, x, primaryRowTerm(height, y, v), e, u);
+}
+
+// coordinate of grid line k along an axis of the given length
+static inline int gridLine(int k, int length) {
+  return min(k * ADAPTIVE_STEP, length - 1);
+}
+
+static void resizeAdaptiveGrid(adaptiveGrid *g, int height, int width) {
+  int cols = (width + ADAPTIVE_STEP - 2) / ADAPTIVE_STEP + 1;
+  int rows = (height + ADAPTIVE_STEP - 2) / ADAPTIVE_STEP + 1;
+  if (g->cols == cols && g->rows == rows)
+    return;
+
+  free(g->ids);
+  free(g->colors);
+  free(g->firstSphere);
+  g->cols = cols;
+  g->rows = rows;
+  g->ids = (int *)malloc((size_t)cols * rows * sizeof(int));
+  g->colors = (float *)malloc(3 * (size_t)cols * rows * sizeof(float));
+  g->firstSphere = (int *)malloc((size_t)(cols - 1) * (rows - 1) * sizeof(int));
+  assert(g->ids != NULL && g->colors != NULL && g->firstSphere != NULL);
+}
+
+static void freeAdaptiveGrid(adaptiveGrid *g) {
+  free(g->ids);
+  free(g->colors);
+  free(g->firstSphere);
+  memset(g, 0, sizeof(adaptiveGrid));
+}
+
+// distance from the center of s within which every hit point computed on it
+// lies: hit points are rounded by up to about sqrt(FLT_EPSILON) times the
+// distance to the eye along grazing rays
+static inline double hitReach(const frameSetup *fs, const sphere *s) {
+  return s->r + 1e-3 * (s->r + qdist(s->pos, fs->e)) + 1e-3;
+}
+
+// returns 1 if the range boundary of a light of fs may pass through sphere i,
+// so that the light lights part of the sphere and not the rest
+static int rangeCrossesSphere(const frameSetup *fs, int i) {
+  const sphere *s = &fs->spheres[i];
+  double reach = hitReach(fs, s);
+  for (int j = 0; j < fs->numLights; j++) {
+    const lightSetup *l = &fs->lightConsts[j];
+    if (l->rangeSq == INFINITY)
+      continue;
+    double dx = (double)l->pos.x - s->pos.x;
+    double dy = (double)l->pos.y - s->pos.y;
+    double dz = (double)l->pos.z - s->pos.z;
+    double d = sqrt(dx * dx + dy * dy + dz * dz);
+    double range = sqrt((double)l->rangeSq);
+    if (d + reach >= range * (1 - 1e-5) && d - reach <= range * (1 + 1e-5))
+      return 1;
+  }
+  return 0;
+}
+
+// returns 1 if the block can be interpolated from its four corners: they hit
+// the same sphere k (or all miss), no sphere before k in sorted order can
+// cover the block, no light range ends on k (if rangeCut is not NULL) and the
+// corner colors are within the threshold
+static inline int smoothBlock(const adaptiveGrid *g,
+                              const unsigned char *rangeCut, int bx, int by) {
+  int corners[4] = {by * g->cols + bx, by * g->cols + bx + 1,
+                    (by + 1) * g->cols + bx, (by + 1) * g->cols + bx + 1};
+  int id = g->ids[corners[0]];
+  for (int k = 1; k < 4; k++) {
+    if (g->ids[corners[k]] != id)
+      return 0;
+  }
+
+  int first = g->firstSphere[by * (g->cols - 1) + bx];
+  if (first != (id == -1 ? INT_MAX : id))
+    return 0;
+  // the corners may all lie on one side of a range boundary crossing the block
+  if (rangeCut != NULL && id != -1 && rangeCut[id])
+    return 0;
+
+  for (int c = 0; c < 3; c++) {
+    float lo = g->colors[3 * corners[0] + c];
+    float hi = lo;
+    for (int k = 1; k < 4; k++) {
+      lo = fminf(lo, g->colors[3 * corners[k] + c]);
+      hi = fmaxf(hi, g->colors[3 * corners[k] + c]);
+    }
+    if (hi - lo > adaptiveThreshold)
+      return 0;
+  }
+  return 1;
+}
+
+// traces every ADAPTIVE_STEP-th pixel, then traces the remaining pixels of
+// blocks that may contain an edge or a sharp shading change and interpolates
+// the others
+// returns the number of pixels traced
+static long long renderAdaptive(adaptiveGrid *g, const frameSetup *fs,
+                                void *img, int height, int width,
+                                const vector *dirs, vector e, vector u,
+                                vector v) {
+  resizeAdaptiveGrid(g, height, width);
+  fbFormat format = framebufferFormat;
+  size_t numPixels = (size_t)height * width;
+
+  cilk_for (int gy = 0; gy < g->rows; gy++) {
+    int y = gridLine(gy, height);
+    for (int gx = 0; gx < g->cols; gx++) {
+      int x = gridLine(gx, width);
+      float *rgb = &g->colors[3 * ((size_t)gy * g->cols + gx)];
+      g->ids[gy * g->cols + gx] =
+          tracePixel(fs, pixelRay(dirs, height, width, x, y, e, u, v), rgb);
+      storePixel(img, format, (size_t)y * width + x, numPixels, rgb);
+    }
+  }
+
+  // first sphere, in sorted order, whose footprint overlaps each block
+  screenBounds *bounds =
+      (screenBounds *)malloc(max(fs->numSpheres, 1) * sizeof(screenBounds));
+  assert(bounds != NULL);
+  cilk_for (int i = 0; i < fs->numSpheres; i++) {
+    bounds[i] = sphereScreenBounds(&fs->spheres[i], height, width, e, u, v);
+  }
+
+  // spheres whose shading a light range cuts off partway
+  unsigned char *rangeCut = NULL;
+  for (int j = 0; j < fs->numLights && rangeCut == NULL; j++) {
+    if (fs->lightConsts[j].rangeSq != INFINITY) {
+      rangeCut = (unsigned char *)malloc(max(fs->numSpheres, 1));
+      assert(rangeCut != NULL);
+      cilk_for (int i = 0; i < fs->numSpheres; i++) {
+        rangeCut[i] = rangeCrossesSphere(fs, i);
+      }
+    }
+  }
+
+  long long traced = 0;
+  long long *tracedRows = (long long *)malloc((g->rows - 1) * sizeof(long long));
+  assert(tracedRows != NULL);
+
+  cilk_for (int by = 0; by < g->rows - 1; by++) {
+    int *first = &g->firstSphere[by * (g->cols - 1)];
+    int y0 = gridLine(by, height), y1 = gridLine(by + 1, height);
+    for (int bx = 0; bx < g->cols - 1; bx++) {
+      first[bx] = INT_MAX;
+    }
+    for (int i = fs->numSpheres - 1; i >= 0; i--) {
+      screenBounds b = bounds[i];
+      if (b.minX > b.maxX || b.maxY < y0 || b.minY > y1)
+        continue;
+      int bx0 = max((b.minX - 1) / ADAPTIVE_STEP, 0);
+      int bx1 = min(b.maxX / ADAPTIVE_STEP, g->cols - 2);
+      for (int bx = bx0; bx <= bx1; bx++) {
+        first[bx] = i;
+      }
+    }
+
+    // each block owns its bottom and left edges, plus the top and right
+    // edges of the image
+    long long rowTraced = 0;
+    int yEnd = (by == g->rows - 2) ? y1 : y1 - 1;
+    for (int bx = 0; bx < g->cols - 1; bx++) {
+      int x0 = gridLine(bx, width), x1 = gridLine(bx + 1, width);
+      int xEnd = (bx == g->cols - 2) ? x1 : x1 - 1;
+      int smooth = smoothBlock(g, rangeCut, bx, by);
+      const float *c00 = &g->colors[3 * (by * g->cols + bx)];
+      const float *c10 = c00 + 3;
+      const float *c01 = &g->colors[3 * ((by + 1) * g->cols + bx)];
+      const float *c11 = c01 + 3;
+
+      for (int y = y0; y <= yEnd; y++) {
+        for (int x = x0; x <= xEnd; x++) {
+          if ((x == x0 || x == x1) && (y == y0 || y == y1))
+            continue; // grid point, already traced
+          float rgb[3];
+          if (smooth) {
+            float fx = (float)(x - x0) / (x1 - x0);
+            float fy = (float)(y - y0) / (y1 - y0);
+            for (int c = 0; c < 3; c++) {
+              rgb[c] = (1 - fy) * ((1 - fx) * c00[c] + fx * c10[c]) +
+                       fy * ((1 - fx) * c01[c] + fx * c11[c]);
+            }
+          } else {
+            tracePixel(fs, pixelRay(dirs, height, width, x, y, e, u, v),
+                       rgb);
+            rowTraced++;
+          }
+          storePixel(img, format, (size_t)y * width + x, numPixels, rgb);
+        }
+      }
+    }
+    tracedRows[by] = rowTraced;
+  }
+
+  for (int by = 0; by < g->rows - 1; by++) {
+    traced += tracedRows[by];
+  }
+  free(tracedRows);
+  free(bounds);
+  free(rangeCut);
+
+  return traced + (long long)g->rows * g->cols;
+}
+
+// returns 1 if the lights of fs are worth binning
+static int needLightClusters(const frameSetup *fs) {
+  if (!clusteredLights || fs->numLights <= MAX_NUM_LIGHTS)
+    return 0;
+  for (int j = 0; j < fs->numLights; j++) {
+    if (fs->lightConsts[j].rangeSq != INFINITY)
+      return 1;
+  }
+  return 0;
+}
+
+// bins the lights of fs by sphere: a light is kept for a sphere when its range
+// reaches the sphere, padded to contain every hit point computed on it
+static void buildLightClusters(lightClusters *lc, const frameSetup *fs) {
+  size_t numIds = (size_t)fs->numSpheres * fs->numLights;
+  if (fs->numSpheres > lc->capacity) {
+    free(lc->counts);
+    lc->capacity = fs->numSpheres;
+    lc->counts = (int *)malloc(lc->capacity * sizeof(int));
+    assert(lc->counts != NULL);
+  }
+  if (numIds > lc->idCapacity) {
+    free(lc->ids);
+    lc->idCapacity = numIds;
+    lc->ids = (int *)malloc(numIds * sizeof(int));
+    assert(lc->ids != NULL);
+  }
+  lc->stride = fs->numLights;
+
+  cilk_for (int i = 0; i < fs->numSpheres; i++) {
+    const sphere *s = &fs->spheres[i];
+    double reach = hitReach(fs, s);
+    int *ids = &lc->ids[(size_t)i * lc->stride];
+    int count = 0;
+    for (int j = 0; j < fs->numLights; j++) {
+      const lightSetup *l = &fs->lightConsts[j];
+      if (l->rangeSq != INFINITY) {
+        double dx = (double)l->pos.x - s->pos.x;
+        double dy = (double)l->pos.y - s->pos.y;
+        double dz = (double)l->pos.z - s->pos.z;
+        double d = sqrt(dx * dx + dy * dy + dz * dz);
+        if (d - reach > sqrt((double)l->rangeSq) * (1 + 1e-5))
+          continue;
+      }
+      ids[count++] = j;
+    }
+    lc->counts[i] = count;
+  }
+}
+
+static void freeLightClusters(lightClusters *lc) {
+  free(lc->counts);
+  free(lc->ids);
+  memset(lc, 0, sizeof(lightClusters));
+}
+
+// returns 1 if the hits in hb were traced for these spheres, camera and image
+// size
+static int sameGeometry(const hitBuffer *hb, int height, int width,
+                        const sphere *spheres, int numSpheres, vector e,
+                        vector u, vector v) {
+  if (!hb->valid || hb->height != height || hb->width != width ||
+      !equals(hb->e, e) || !equals(hb->u, u) || !equals(hb->v, v) ||
+      hb->numSpheres != numSpheres)
+    return 0;
+  for (int i = 0; i < numSpheres; i++) {
+    if (!sameSphere(&hb->spheres[i], &spheres[i]))
+      return 0;
+  }
+  return 1;
+}
+
+// sizes hb for a height x width image and records the geometry about to be
+// traced into it
+static hitBuffer *prepareHitBuffer(hitBuffer *hb, int height, int width,
+                                   const sphere *spheres, int numSpheres,
+                                   vector e, vector u, vector v) {
+  size_t numPixels = (size_t)height * width;
+  if (!hb->valid || (size_t)hb->height * hb->width != numPixels) {
+    free(hb->ids);
+    free(hb->ts);
+    free(hb->normals);
+    hb->ids = (int *)malloc(numPixels * sizeof(int));
+    hb->ts = (float *)malloc(numPixels * sizeof(float));
+    hb->normals = (uint32_t *)malloc(numPixels * sizeof(uint32_t));
+    assert(hb->ids != NULL && hb->ts != NULL && hb->normals != NULL);
+  }
+  if (numSpheres > hb->capacity) {
+    hb->capacity = numSpheres;
+    hb->spheres = (sphere *)realloc(hb->spheres, numSpheres * sizeof(sphere));
+    assert(hb->spheres != NULL);
+  }
+
+  memcpy(hb->spheres, spheres, numSpheres * sizeof(sphere));
+  hb->numSpheres = numSpheres;
+  hb->height = height;
+  hb->width = width;
+  hb->e = e;
+  hb->u = u;
+  hb->v = v;
+  hb->valid = 1;
+  return hb;
+}
+
+static void freeHitBuffer(hitBuffer *hb) {
+  free(hb->spheres);
+  free(hb->ids);
+  free(hb->ts);
+  free(hb->normals);
+  memset(hb, 0, sizeof(hitBuffer));
+}
+
+// shades every pixel of hb with the lights of fs; the hit points are rebuilt
+// from the ray parameters, the normals are the quantized ones
+static void shadeHitBuffer(const hitBuffer *hb, const frameSetup *fs,
+                           void *img, const vector *dirs) {
+  int height = hb->height, width = hb->width;
+  fbFormat format = framebufferFormat;
+  size_t numPixels = (size_t)height * width;
+
+  cilk_for (int y = 0; y < height; y++) {
+    vector rowTerm = primaryRowTerm(height, y, hb->v);
+    size_t row = (size_t)y * width;
+    for (int x = 0; x < width; x++) {
+      int id = hb->ids[row + x];
+      float rgb[3] = {0, 0, 0};
+      if (id >= 0) {
+        vector dir =
+            dirs ? dirs[row + x] : primaryRay(width, x, rowTerm, hb->e, hb->u);
+        vector p = qadd(hb->e, scale(hb->ts[row + x], dir));
+        shadeLambert(fs, &hb->spheres[id], p, decodeNormal(hb->normals[row + x]),
+                     fs->numLights, NULL, rgb);
+      }
+      storePixel(img, format, row + x, numPixels, rgb);
+    }
+  }
+}
+
+int relight(context *ctx, void *img, int numLights, light *lights) {
+  renderCache *rc = &ctx->cache;
+  hitBuffer *hits = &rc->hits;
+  if (!hits->valid)
+    return 0;
+
+  const vector *dirs = NULL;
+  if (useRayCache) {
+    updateRayCache(&rc->primaryRays, hits->height, hits->width, hits->e,
+                   hits->u, hits->v);
+    dirs = rc->primaryRays.dirs;
+  }
+
+  setupLights(&rc->frame, numLights, lights);
+  shadeHitBuffer(hits, &rc->frame, img, dirs);
+  return 1;
+}
+
+void renderReset(context *ctx) {
+  renderCache *rc = &ctx->cache;
+  freeFrameSetup(&rc->frame);
+  freeRayCache(&rc->primaryRays);
+  freeDirtyState(&rc->prevFrame);
+  freeAdaptiveGrid(&rc->grid);
+  freeHitBuffer(&rc->hits);
+  freeLightClusters(&rc->clusters);
+  freeBVH(&rc->sceneTree);
+  for (int k = 0; k < rc->numViewSetups; k++) {
+    freeFrameSetup(&rc->viewSetups[k].fs);
+    free(rc->viewSetups[k].keys);
+    free(rc->viewSetups[k].nodeKeys);
+  }
+  free(rc->viewSetups);
+  rc->viewSetups = NULL;
+  rc->numViewSetups = 0;
+  rc->progressive.valid = 0;
+  memset(&rc->totals, 0, sizeof(renderStats));
+}
+
+static void renderTreeViews(context *ctx, void **imgs, int numViews,
+                            const camera *cams, int height, int width,
+                            sphere *spheres, int numSpheres, int numLights,
+                            light *lights);
+
+void renderSpheres(context *ctx, void *img, int height, int width,
+                   sphere *spheres, int numSpheres, vector e, vector u,
+                   vector v, int numLights, light *lights) {
+  renderCache *rc = &ctx->cache;
+  frameSetup *frame = &rc->frame;
+  if (useSceneTree) {
+    // img stops being the frame the other caches remember
+    rc->prevFrame.valid = 0;
+    rc->hits.valid = 0;
+    camera c = {e, u, v};
+    renderTreeViews(ctx, &img, 1, &c, height, width, spheres, numSpheres,
+                    numLights, lights);
+    return;
+  }
+
+  int exact = adaptiveThreshold < 0 || height <= 1 || width <= 1;
+  if (useHitBuffer && exact &&
+      sameGeometry(&rc->hits, height, width, spheres, numSpheres, e, u, v)) {
+    relight(ctx, img, numLights, lights);
+    rc->totals.pixelsTotal += (long long)height * width;
+    // img now differs from the traced frame by the normal quantization
+    rc->prevFrame.valid = 0;
+    return;
+  }
+
+  setupFrame(frame, spheres, numSpheres, e, numLights, lights);
+
+  const vector *dirs = NULL;
+  if (useRayCache) {
+    updateRayCache(&rc->primaryRays, height, width, e, u, v);
+    dirs = rc->primaryRays.dirs;
+  }
+
+  if (!exact) {
+    rc->hits.valid = 0;
+    rc->totals.pixelsTraced +=
+        renderAdaptive(&rc->grid, frame, img, height, width, dirs, e, u, v);
+    rc->totals.pixelsTotal += (long long)height * width;
+    return;
+  }
+
+  const unsigned char *mask = NULL;
+  long long traced = (long long)height * width;
+  if (incrementalRender) {
+    long long dirty =
+        updateDirtyState(&rc->prevFrame, img, height, width, spheres,
+                         numSpheres, e, u, v, numLights, lights);
+    // pixels left alone must also keep valid hits
+    if (dirty >= 0 && (!useHitBuffer || rc->hits.valid)) {
+      mask = rc->prevFrame.mask;
+      traced = dirty;
+    }
+  }
+  rc->totals.pixelsTraced += traced;
+  rc->totals.pixelsTotal += (long long)height * width;
+
+  if (needLightClusters(frame)) {
+    buildLightClusters(&rc->clusters, frame);
+    frame->clusters = &rc->clusters;
+  }
+
+  hitBuffer *hb = useHitBuffer ? prepareHitBuffer(&rc->hits, height, width,
+                                                  spheres, numSpheres, e, u, v)
+                              : NULL;
+  renderRows(frame, img, height, width, 0, height, dirs, mask, hb, e, u, v);
+}
+
+void render(context *ctx, void *img, int height, int width, vector e, vector u,
+            vector v, int numLights, light *lights) {
+  renderSpheres(ctx, img, height, width, ctx->spheres, ctx->numSpheres, e, u,
+                v, numLights, lights);
+}
+
+// traces the samples of the pass with block side step on its rows in
+// [y0, y1) and fills their blocks; on rows shared with the coarser pass
+// before it, only every other sample is new
+// returns the number of pixels traced
+static long long renderProgressiveRows(const frameSetup *fs, void *img,
+                                       int height, int width, int step,
+                                       int firstPass, int y0, int y1,
+                                       const vector *dirs, vector e, vector u,
+                                       vector v) {
+  fbFormat format = framebufferFormat;
+  size_t numPixels = (size_t)height * width;
+  int numRows = (y1 - y0 + step - 1) / step;
+
+  cilk_for (int r = 0; r < numRows; r++) {
+    int y = y0 + r * step;
+    int sharedRow = !firstPass && y % (2 * step) == 0;
+    int yEnd = min(y + step, height);
+    for (int x = sharedRow ? step : 0; x < width;
+         x += sharedRow ? 2 * step : step) {
+      float rgb[3];
+      tracePixel(fs, pixelRay(dirs, height, width, x, y, e, u, v), rgb);
+      int xEnd = min(x + step, width);
+      for (int by = y; by < yEnd; by++) {
+        for (int bx = x; bx < xEnd; bx++) {
+          storePixel(img, format, (size_t)by * width + bx, numPixels, rgb);
+        }
+      }
+    }
+  }
+
+  long long traced = 0;
+  for (int y = y0; y < y1; y += step) {
+    int sharedRow = !firstPass && y % (2 * step) == 0;
+    traced += sharedRow ? (width + step - 1) / (2 * step)
+                        : (width + step - 1) / step;
+  }
+  return traced;
+}
+
+void progressiveRestart(context *ctx) { ctx->cache.progressive.valid = 0; }
+
+int renderProgressive(context *ctx, void *img, int height, int width,
+                      vector e, vector u, vector v, int numLights,
+                      light *lights, double budget) {
+  fasttime_t start = gettime();
+  renderCache *rc = &ctx->cache;
+  progressiveState *ps = &rc->progressive;
+  if (!ps->valid || ps->height != height || ps->width != width ||
+      !equals(ps->e, e) || !equals(ps->u, u) || !equals(ps->v, v) ||
+      ps->numLights != numLights || ps->numSpheres != ctx->numSpheres) {
+    ps->valid = 1;
+    ps->height = height;
+    ps->width = width;
+    ps->e = e;
+    ps->u = u;
+    ps->v = v;
+    ps->numLights = numLights;
+    ps->numSpheres = ctx->numSpheres;
+    ps->step = PROGRESSIVE_STEP;
+    ps->nextRow = 0;
+  }
+  if (ps->step == 0)
+    return 1;
+
+  // img stops being the frame the other caches remember
+  rc->prevFrame.valid = 0;
+  rc->hits.valid = 0;
+
+  frameSetup *frame = &rc->frame;
+  setupFrame(frame, ctx->spheres, ctx->numSpheres, e, numLights, lights);
+  const vector *dirs = NULL;
+  if (useRayCache) {
+    updateRayCache(&rc->primaryRays, height, width, e, u, v);
+    dirs = rc->primaryRays.dirs;
+  }
+
+  // at least one row, so that every call makes progress; later chunks are
+  // sized to what is left of the budget
+  long long traced = 0;
+  double elapsed = 0;
+  do {
+    int step = ps->step;
+    int samplesPerRow = (width + step - 1) / step;
+    double samples = PROGRESSIVE_CHUNK;
+    if (ps->sampleCost > 0) {
+      samples = fmin(samples, (budget - elapsed) / ps->sampleCost);
+    }
+    int rows = max((int)(samples / samplesPerRow), 1);
+    int y1 = min(ps->nextRow + rows * step, height);
+
+    fasttime_t chunkStart = gettime();
+    long long chunk = renderProgressiveRows(
+        frame, img, height, width, step, step == PROGRESSIVE_STEP,
+        ps->nextRow, y1, dirs, e, u, v);
+    fasttime_t chunkStop = gettime();
+    ps->sampleCost = tdiff_sec(chunkStart, chunkStop) / chunk;
+    traced += chunk;
+    elapsed = tdiff_sec(start, chunkStop);
+
+    ps->nextRow = y1;
+    if (ps->nextRow >= height) {
+      ps->step /= 2;
+      ps->nextRow = 0;
+    }
+  } while (ps->step > 0 && elapsed < budget);
+
+  rc->totals.pixelsTraced += traced;
+  if (ps->step == 0) {
+    rc->totals.pixelsTotal += (long long)height * width;
+  }
+  return ps->step == 0;
+}
+
+void renderBand(context *ctx, void *band, int height, int width, int y0,
+                int y1, vector e, vector u, vector v, int numLights,
+                light *lights) {
+  renderCache *rc = &ctx->cache;
+  frameSetup *frame = &rc->frame;
+  setupFrame(frame, ctx->spheres, ctx->numSpheres, e, numLights, lights);
+  if (needLightClusters(frame)) {
+    buildLightClusters(&rc->clusters, frame);
+    frame->clusters = &rc->clusters;
+  }
+  rc->totals.pixelsTraced += (long long)(y1 - y0) * width;
+  rc->totals.pixelsTotal += (long long)(y1 - y0) * width;
+  renderRows(frame, band, height, width, y0, y1, NULL, NULL, NULL, e, u, v);
+}
+
+// finds the sphere tracePixel would hit for view vs, using the tree to skip
+// spheres the ray misses or that come after the best hit so far in sorted
+// order
+// returns the index of the sphere hit and sets *tHit, or returns -1
+static inline int bvhFirstHit(const bvh *b, const viewSetup *vs, vector dir,
+                              float *tHit) {
+  if (b->numNodes == 0)
+    return -1;
+
+  const frameSetup *fs = &vs->fs;
+  const float *keys = vs->keys;
+  float a = qdot(dir, dir);
+  float origin[3] = {fs->e.x, fs->e.y, fs->e.z};
+  float invDir[3] = {1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z};
+  int best = -1;
+  float bestKey = INFINITY;
+  int tests = 0;
+
+  int stack[64];
+  int top = 0;
+  stack[top++] = 0;
+
+  while (top > 0) {
+    int index = stack[--top];
+    const bvhNode *node = &b->nodes[index];
+
+    // every sphere below this node is farther from the eye than the best hit
+    if (vs->nodeKeys[index] > bestKey)
+      continue;
+    if (!rayHitsBox(node->lo, node->hi, origin, invDir, 20000.0f))
+      continue;
+
+    if (node->left < 0) {
+      for (int k = node->first; k < node->first + node->count; k++) {
+        int i = b->order[k];
+        if (keys[i] > bestKey || (keys[i] == bestKey && i > best))
+          continue;
+        float t = 20000.0Q; // approx. infinity
+        tests++;
+        if (rayToSphereSetupIntersection(dir, a, &fs->sphereConsts[i], &t)) {
+          best = i;
+          bestKey = keys[i];
+          *tHit = t;
+        }
+      }
+      continue;
+    }
+
+    // visit the child whose spheres may be nearer to the eye first
+    int near = node->left, far = node->left + 1;
+    if (vs->nodeKeys[far] < vs->nodeKeys[near]) {
+      near = far;
+      far = node->left;
+    }
+    stack[top++] = far;
+    stack[top++] = near;
+  }
+
+  STAT_ADD(STAT_RAY_TESTS, tests);
+  STAT_ADD(STAT_RAY_HITS, best >= 0);
+  (void)tests;
+  return best;
+}
+
+// renders the sorted spheres[0..numSpheres) from numViews cameras into
+// imgs[0..numViews), sharing one bounding volume hierarchy between all views
+static void renderTreeViews(context *ctx, void **imgs, int numViews,
+                            const camera *cams, int height, int width,
+                            sphere *spheres, int numSpheres, int numLights,
+                            light *lights) {
+  renderCache *rc = &ctx->cache;
+  bvh *sceneTree = &rc->sceneTree;
+  buildBVH(sceneTree, spheres, numSpheres);
+
+  if (numViews > rc->numViewSetups) {
+    rc->viewSetups =
+        (viewSetup *)realloc(rc->viewSetups, numViews * sizeof(viewSetup));
+    assert(rc->viewSetups != NULL);
+    memset(&rc->viewSetups[rc->numViewSetups], 0,
+           (numViews - rc->numViewSetups) * sizeof(viewSetup));
+    rc->numViewSetups = numViews;
+  }
+  viewSetup *viewSetups = rc->viewSetups;
+
+  cilk_for (int k = 0; k < numViews; k++) {
+    viewSetup *vs = &viewSetups[k];
+    setupFrame(&vs->fs, spheres, numSpheres, cams[k].e, numLights, lights);
+    if (numSpheres > vs->capacity) {
+      free(vs->keys);
+      vs->keys = (float *)malloc(numSpheres * sizeof(float));
+      assert(vs->keys != NULL);
+      vs->capacity = numSpheres;
+    }
+    for (int i = 0; i < numSpheres; i++) {
+      vs->keys[i] = qdist(spheres[i].pos, cams[k].e);
+    }
+
+    if (sceneTree->numNodes > vs->nodeCapacity) {
+      free(vs->nodeKeys);
+      vs->nodeKeys = (float *)malloc(sceneTree->numNodes * sizeof(float));
+      assert(vs->nodeKeys != NULL);
+      vs->nodeCapacity = sceneTree->numNodes;
+    }
+    // shrink the exact bound to absorb the rounding of qdist
+    for (int n = 0; n < sceneTree->numNodes; n++) {
+      const bvhNode *node = &sceneTree->nodes[n];
+      double d = boxDistance(node->centerLo, node->centerHi, cams[k].e);
+      vs->nodeKeys[n] = (float)((d - 1e-6) / (1 + 2e-6));
+    }
+  }
+
+  fbFormat format = framebufferFormat;
+  size_t numPixels = (size_t)height * width;
+
+  cilk_for (int k = 0; k < numViews; k++) {
+    const viewSetup *vs = &viewSetups[k];
+    camera c = cams[k];
+
+    cilk_for (int y = 0; y < height; y++) {
+      vector rowTerm = primaryRowTerm(height, y, c.v);
+      for (int x = 0; x < width; x++) {
+        vector dir = primaryRay(width, x, rowTerm, c.e, c.u);
+        float t = 0;
+        int id = bvhFirstHit(sceneTree, vs, dir, &t);
+        float rgb[3];
+        shadeHit(&vs->fs, dir, id, t, vs->fs.numLights, NULL, rgb, NULL);
+        storePixel(imgs[k], format, (size_t)y * width + x, numPixels, rgb);
+      }
+    }
+  }
+
+  rc->totals.pixelsTraced += (long long)numViews * height * width;
+  rc->totals.pixelsTotal += (long long)numViews * height * width;
+}
+
+void renderViews(context *ctx, void **imgs, int numViews, const camera *cams,
+                 int height, int width, int numLights, light *lights) {
+  renderTreeViews(ctx, imgs, numViews, cams, height, width, ctx->spheres,
+                  ctx->numSpheres, numLights, lights);
+}
+
+void cameraRig(camera c, float separation, int numViews, camera *cams) {
+  for (int k = 0; k < numViews; k++) {
+    float offset = (k - (numViews - 1) / 2.0f) * separation;
+    cams[k] = c;
+    cams[k].e = qadd(c.e, scale(offset, c.u));
+  }
+}
+
+void renderOrig(context *ctx, float *img, int height, int width, vector e,
+                vector u, vector v, int numLights, light *lights) {
+  sphere *spheres = ctx->spheres;
+  int numSpheres = ctx->numSpheres;
   ray r;
 
   for (int y = 0; y < height; y++) {
@@ -106,6 +1343,9 @@ void renderOrig(float *img, int height, int width, vector e, vector u, vector v,
         vector dist = qsubtract(currentLight.pos, newOrigin);
         if (qdot(n, dist) <= 0)
           continue;
+        if (currentLight.range > 0 &&
+            qdot(dist, dist) > currentLight.range * currentLight.range)
+          continue;
 
         ray lightRay;
         lightRay.origin = newOrigin;
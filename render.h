@@ -5,6 +5,11 @@
 #ifndef RAY_TRACER_H
 #define RAY_TRACER_H
 
+#include <math.h>
+#include <stdint.h>
+
+#include "bvh.h"
+#include "framebuffer.h"
 #include "simulate.h"
 
 #define min(a, b) (((a) < (b)) ? (a) : (b))
@@ -14,19 +19,291 @@
 #define WIDTH 512
 #define HEIGHT 256
 
-// Max number of objects and lights in scene
+// Max number of objects in scene
 #define MAX_NUM_SPHERES 3
+
+// Number of default lights, also the largest light count that has its own
+// specialized render kernels
 #define MAX_NUM_LIGHTS 3
 
+// Per-sphere intersection constants for rays leaving the eye. Every primary
+// ray shares the origin e, so dist = e - pos and c = |dist|^2 - r^2 depend only
+// on the sphere and the camera and are computed once per frame.
+typedef struct {
+  vector dist;
+  float c;
+} __attribute__((aligned(16))) sphereSetup;
+
+// Per-light shading constants, stored contiguously for the Lambert loop.
+// rangeSq is the squared range, infinite for lights without one.
+typedef struct {
+  vector pos;
+  color intensity;
+  float rangeSq;
+} __attribute__((aligned(32))) lightSetup;
+
+// Lights binned by the sphere they shade: the counts[i] lights listed in
+// increasing order from ids[i * stride] may reach sphere i, the others are out
+// of range of all of its points
+typedef struct {
+  int stride;
+  int capacity;
+  size_t idCapacity;
+  int *counts;
+  int *ids;
+} lightClusters;
+
+// Everything the renderer needs for one frame, built by setupFrame; clusters
+// is NULL unless the lights have been binned for this frame
+typedef struct {
+  vector e;
+  sphere *spheres;
+  int numSpheres;
+  int capacity;
+  sphereSetup *sphereConsts;
+  int numLights;
+  int lightCapacity;
+  lightSetup *lightConsts;
+  const lightClusters *clusters;
+} frameSetup;
+
+// Eye position and image plane basis of one view
+typedef struct {
+  vector e, u, v;
+} camera;
+
+// Per-view state of renderViews: the frame setup for the view's eye, the
+// distance from the eye to every sphere, which orders the spheres the way
+// sort() would for that eye, and for every tree node a lower bound on the
+// distances of the spheres below it
+typedef struct {
+  frameSetup fs;
+  float *keys;
+  int capacity;
+  float *nodeKeys;
+  int nodeCapacity;
+} viewSetup;
+
+// Normalized primary ray directions for every pixel, kept across frames and
+// rebuilt only when the camera basis or the image size changes
+typedef struct {
+  vector e, u, v;
+  int height, width;
+  int valid;
+  vector *dirs;
+} rayCache;
+
+// Inclusive pixel rectangle covered by a sphere; empty when minX > maxX
+typedef struct {
+  int minX, minY, maxX, maxY;
+} screenBounds;
+
+// Previous frame as seen by the incremental renderer, used to find the pixels
+// that can change between two consecutive render() calls
+typedef struct {
+  int valid;
+  void *img;
+  int height, width;
+  vector e, u, v;
+  int numLights;
+  int lightCapacity;
+  light *lights;
+  int numSpheres;
+  int capacity;
+  sphere *spheres;
+  screenBounds *bounds;
+  unsigned char *mask;
+} dirtyState;
+
+// Spacing of the coarse grid traced first by the adaptive renderer
+#define ADAPTIVE_STEP 4
+
+// Coarse grid of the adaptive renderer: hit sphere and color at every grid
+// point, and for each block between grid points the first sphere (in sorted
+// order) whose screen bounds overlap it, INT_MAX if none
+typedef struct {
+  int rows, cols;
+  int *ids;
+  float *colors;
+  int *firstSphere;
+} adaptiveGrid;
+
+// Primary hit of every pixel of the last traced frame, kept so that a change
+// of lights alone is handled by reshading: the sphere hit (-1 for none), the
+// ray parameter of the hit and the unit normal there, octahedron-encoded into
+// two 16-bit fixed-point coordinates. The camera and a copy of the spheres
+// identify the geometry the hits belong to.
+typedef struct {
+  int valid;
+  int height, width;
+  vector e, u, v;
+  int numSpheres;
+  int capacity;
+  sphere *spheres;
+  int *ids;
+  float *ts;
+  uint32_t *normals;
+} hitBuffer;
+
+// Side of the blocks filled by the first pass of renderProgressive(); every
+// later pass halves it, down to single pixels
+#define PROGRESSIVE_STEP 16
+
+// Most samples traced by renderProgressive() between two checks of its
+// budget
+#define PROGRESSIVE_CHUNK 8192
+
+// Image refined across renderProgressive() calls: the frame it shows, and
+// how far the passes over it got
+typedef struct {
+  int valid;
+  int height, width;
+  vector e, u, v;
+  int numLights;
+  int numSpheres;
+  int step;    // block side of the pass under way, 0 once every pixel is
+               // traced
+  int nextRow; // first row of that pass not traced yet
+  double sampleCost; // seconds per sample measured so far, sizes the chunks
+} progressiveState;
+
+// Pixel counts accumulated by render() since the last renderReset()
+typedef struct {
+  long long pixelsTraced;
+  long long pixelsTotal;
+} renderStats;
+
+// Everything the renderer keeps between the frames of one scene: the setup of
+// the frame being rendered and the caches of the optional render modes
+typedef struct {
+  frameSetup frame;
+  rayCache primaryRays;
+  dirtyState prevFrame;
+  adaptiveGrid grid;
+  hitBuffer hits;
+  lightClusters clusters;
+  progressiveState progressive;
+
+  // spatial data shared by the views of renderViews
+  bvh sceneTree;
+  viewSetup *viewSetups;
+  int numViewSetups;
+
+  renderStats totals;
+} renderCache;
+
+// when nonzero, render() reads primary rays from a persistent rayCache
+extern int useRayCache;
+
+// when nonzero, render() only re-renders pixels whose spheres changed
+extern int incrementalRender;
+
+// when nonnegative, render() samples adaptively and interpolates blocks whose
+// corner colors differ by at most this much in every channel
+extern float adaptiveThreshold;
+
+// when nonzero, render() dispatches to kernels specialized for the light
+// count and for the default image size
+extern int specializedKernels;
+
+// when nonzero, render() keeps a hitBuffer and only reshades it when the
+// geometry and camera are those of the last traced frame
+extern int useHitBuffer;
+
+// when nonzero, render() finds hits through a bounding volume hierarchy
+// rebuilt every frame, as renderViews() does, instead of testing the spheres
+// in sorted order; the other render options are then ignored
+extern int useSceneTree;
+
+// when nonzero, render() bins lights by the spheres within their range once
+// there are more than MAX_NUM_LIGHTS of them and some have a range
+extern int clusteredLights;
+
 ray eyeToPixel(int height, int width, float i, float j, vector origin, vector u,
                vector v);
 
 int rayToSphereIntersection(ray *r, sphere *s, float *t);
 
-void render(float *img, int height, int width, vector e, vector u, vector v,
-            int numLights, light *lights);
-
-void renderOrig(float *img, int height, int width, vector e, vector u, vector v,
+void setupFrame(frameSetup *fs, sphere *spheres, int numSpheres, vector e,
                 int numLights, light *lights);
 
+// Same test as rayToSphereIntersection for a ray leaving the eye, using the
+// hoisted constants. a = qdot(dir, dir) is computed once per pixel.
+// returns 1 if ray and sphere intersect, else 0
+static inline int rayToSphereSetupIntersection(vector dir, float a,
+                                               const sphereSetup *s, float *t) {
+  float b = 2 * qdot(dir, s->dist);
+  float discr = (float)((double)(b * b) - (double)(4 * a * s->c));
+
+  if (discr >= 0) {
+    float sqrtdiscr = sqrtf(discr);
+    float sol1 = (float)((double)-b + (double)sqrtdiscr) / 2;
+    float sol2 = (float)((double)-b - (double)sqrtdiscr) / 2;
+    float new_t = min(sol1, sol2);
+
+    if (new_t > 0 && new_t < *t) {
+      *t = new_t;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+screenBounds sphereScreenBounds(const sphere *s, int height, int width,
+                                vector e, vector u, vector v);
+
+int updateRayCache(rayCache *rc, int height, int width, vector e, vector u,
+                   vector v);
+
+void freeRayCache(rayCache *rc);
+
+// releases the frame setup and caches ctx keeps between render() calls
+void renderReset(context *ctx);
+
+// renders the spheres of ctx into img, laid out as framebufferFormat
+void render(context *ctx, void *img, int height, int width, vector e, vector u,
+            vector v, int numLights, light *lights);
+
+// renders the sorted spheres[0..numSpheres) instead of the simulation's own,
+// so that a snapshot can be rendered while the simulation moves on
+void renderSpheres(context *ctx, void *img, int height, int width,
+                   sphere *spheres, int numSpheres, vector e, vector u,
+                   vector v, int numLights, light *lights);
+
+// reshades the frame last traced by render() with useHitBuffer set under a
+// different set of lights, writing the whole image into img
+// returns 1 on success, or 0 if there is no hit buffer to reshade
+int relight(context *ctx, void *img, int numLights, light *lights);
+
+// renders the spheres of ctx into img in passes of ever finer samples, each
+// sample filling the block it stands for, until budget seconds have passed;
+// the next call carries on where this one stopped, unless the image size,
+// camera, light count or sphere count changed, which starts the passes over
+// returns 1 once every pixel of img has been traced, else 0
+int renderProgressive(context *ctx, void *img, int height, int width,
+                      vector e, vector u, vector v, int numLights,
+                      light *lights, double budget);
+
+// starts the passes of renderProgressive() over, as the spheres moved
+void progressiveRestart(context *ctx);
+
+// renders rows [y0, y1) of a height x width image into band, which holds
+// (y1 - y0) * width pixels laid out as framebufferFormat
+void renderBand(context *ctx, void *band, int height, int width, int y0,
+                int y1, vector e, vector u, vector v, int numLights,
+                light *lights);
+
+// renders the spheres of ctx from numViews cameras into imgs[0..numViews),
+// sharing one bounding volume hierarchy between all views
+void renderViews(context *ctx, void **imgs, int numViews, const camera *cams,
+                 int height, int width, int numLights, light *lights);
+
+// numViews cameras spaced by separation along u, centered on c; two views
+// form a stereo pair
+void cameraRig(camera c, float separation, int numViews, camera *cams);
+
+void renderOrig(context *ctx, float *img, int height, int width, vector e,
+                vector u, vector v, int numLights, light *lights);
+
 #endif
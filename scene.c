@@ -0,0 +1,677 @@
+/**
+ * Scene files: the text format and a binary format mapped in place
+ **/
+
+#include <assert.h>
+#include <cilk/cilk.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "memory.h"
+#include "scene.h"
+
+// sets the viewpoint, direction and basis vectors every scene starts with
+static void setDefaultView(context *ctx) {
+  // set the viewpoint and direction
+  ctx->e = newVector(800, 100, 0);
+  ctx->viewDirection = newVector(-1, 0, 0);
+
+  // calculate basis vectors
+  vector up = newVector(0, 0, 1);
+  ctx->w = scale(1 / qsize(ctx->viewDirection), ctx->viewDirection);
+  ctx->u = scale(1 / qsize(qcross(up, ctx->w)), qcross(up, ctx->w));
+  ctx->v = qcross(ctx->w, ctx->u);
+}
+
+// gives scenes without lights the default ones, and turns all lights on
+static void setDefaultLights(context *ctx) {
+  if (ctx->numSceneLights <= 0) {
+    ctx->numSceneLights = MAX_NUM_LIGHTS;
+    light *lights =
+        (light *)realloc(ctx->lights, ctx->numSceneLights * sizeof(light));
+    assert(lights != NULL);
+    lights[0] = newLight(newVector(0, 240, -100), newColor(1, 1, 1));
+    lights[1] = newLight(newVector(3200, 3000, -1000), newColor(0.6, 0.7, 1));
+    lights[2] = newLight(newVector(600, 0, -100), newColor(0.3, 0.5, 1));
+    ctx->lights = lights;
+  }
+  ctx->numLights = ctx->numSceneLights;
+}
+
+// scene text is split at line boundaries into chunks of about this many
+// bytes, which are parsed in parallel
+#define PARSE_CHUNK_BYTES (1 << 16)
+
+// number of fields on a sphere line
+#define SPHERE_LINE_FIELDS 12
+
+// offsets of the fields of a sphere line, in the order of the text format
+static const size_t sphereLineFields[SPHERE_LINE_FIELDS] = {
+    offsetof(sphere, r),
+    offsetof(sphere, mass),
+    offsetof(sphere, pos.x),
+    offsetof(sphere, pos.y),
+    offsetof(sphere, pos.z),
+    offsetof(sphere, vel.x),
+    offsetof(sphere, vel.y),
+    offsetof(sphere, vel.z),
+    offsetof(sphere, mat.diffuse.red),
+    offsetof(sphere, mat.diffuse.green),
+    offsetof(sphere, mat.diffuse.blue),
+    offsetof(sphere, mat.reflection)};
+
+// powers of ten that are exact in a double
+static const double exactPowersOfTen[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// A line-aligned slice of the sphere text, parsed by one strand
+typedef struct {
+  const char *begin, *end;
+  size_t firstToken; // index of its first field among all sphere fields
+  size_t numTokens;
+  int rejected;     // 1 if it holds a field the fast parser rejects
+  const char *stop; // end of the last field it parsed
+} textChunk;
+
+// whitespace as isspace sees it in the C locale
+static inline int isSpace(char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// returns the 8 bytes at p as a little-endian integer
+static inline uint64_t loadEightBytes(const char *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap64(v);
+#endif
+  return v;
+}
+
+// returns 1 if all 8 bytes of v are ASCII digits
+static inline int isEightDigits(uint64_t v) {
+  return ((v & 0xF0F0F0F0F0F0F0F0ULL) |
+          (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) ==
+         0x3333333333333333ULL;
+}
+
+// returns the value of the 8 ASCII digits in v, the first in its low byte,
+// with three multiplications instead of eight
+static inline uint32_t eightDigitsValue(uint64_t v) {
+  const uint64_t mask = 0x000000FF000000FFULL;
+  v -= 0x3030303030303030ULL;
+  v = v * 10 + (v >> 8);
+  v = ((v & mask) * (100 + (1000000ULL << 32)) +
+       ((v >> 16) & mask) * (1 + (10000ULL << 32))) >>
+      32;
+  return (uint32_t)v;
+}
+
+// converts the decimal number at s, which ends at end or the first space, to
+// the float strtof gives for it, without locale lookups or copies
+// returns 1 and sets *stop past it, or 0 for anything it cannot convert
+// exactly, for strtof to handle
+static int fastParseFloat(const char *s, const char *end, float *out,
+                          const char **stop) {
+  const char *p = s;
+  int negative = 0;
+  if (p < end && (*p == '+' || *p == '-')) {
+    negative = *p++ == '-';
+  }
+
+  // digits while the mantissa stays below 10^19, exact in a uint64_t; later
+  // ones change the value by less than 1e-18 of it
+  uint64_t mantissa = 0;
+  int exponent = 0, seen = 0;
+  for (; p < end && *p >= '0' && *p <= '9'; p++, seen = 1) {
+    if (mantissa < 1000000000000000000ULL) {
+      mantissa = mantissa * 10 + (*p - '0');
+    } else {
+      exponent++;
+    }
+  }
+  if (p < end && *p == '.') {
+    p++;
+    uint64_t eight;
+    while (mantissa < 100000000000ULL && end - p >= 8 &&
+           isEightDigits(eight = loadEightBytes(p))) {
+      mantissa = mantissa * 100000000 + eightDigitsValue(eight);
+      exponent -= 8;
+      p += 8;
+      seen = 1;
+    }
+    for (; p < end && *p >= '0' && *p <= '9'; p++, seen = 1) {
+      if (mantissa < 1000000000000000000ULL) {
+        mantissa = mantissa * 10 + (*p - '0');
+        exponent--;
+      }
+    }
+  }
+  if (!seen) {
+    return 0; // inf, nan, or not a number
+  }
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    int negativeExponent = 0;
+    if (++p < end && (*p == '+' || *p == '-')) {
+      negativeExponent = *p++ == '-';
+    }
+    if (p == end || *p < '0' || *p > '9') {
+      return 0;
+    }
+    int e = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+      if (e < 1000)
+        e = e * 10 + (*p - '0');
+    }
+    exponent += negativeExponent ? -e : e;
+  }
+  if (p < end && !isSpace(*p)) {
+    return 0; // hexadecimal, or trailing garbage
+  }
+
+  if (mantissa == 0) {
+    *out = negative ? -0.0f : 0.0f;
+    *stop = p;
+    return 1;
+  }
+  if (exponent < -44 || exponent > 44) {
+    return 0;
+  }
+
+  // at most three roundings and the dropped digits: d is within a relative
+  // 2^-51 of the exact value
+  double d = (double)mantissa;
+  if (exponent < -22) {
+    d /= 1e22;
+    exponent += 22;
+  } else if (exponent > 22) {
+    d *= 1e22;
+    exponent -= 22;
+  }
+  d = exponent < 0 ? d / exactPowersOfTen[-exponent]
+                   : d * exactPowersOfTen[exponent];
+  if (!(d >= 0x1p-125 && d < 0x1p127)) {
+    return 0; // subnormal or out of range
+  }
+
+  // f is the correctly rounded float of the exact value unless a halfway
+  // point between two floats is within the error of d; both halfway points
+  // are exact in a double, and f is normal so its neighbors are a bit away
+  float f = (float)d, down, up;
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  bits--;
+  memcpy(&down, &bits, sizeof(down));
+  bits += 2;
+  memcpy(&up, &bits, sizeof(up));
+  double error = d * 0x1p-50;
+  double below = ((double)f + (double)down) / 2;
+  double above = ((double)f + (double)up) / 2;
+  if (!(d - error > below && d + error < above)) {
+    return 0;
+  }
+  *out = negative ? -f : f;
+  *stop = p;
+  return 1;
+}
+
+// parses the field at s, which ends at end or the first space, as fscanf's %f
+// does, and sets *stop past it
+// returns 1 on success, 0 if it is not a number
+static int parseFloatField(const char *s, const char *end, float *out,
+                           const char **stop) {
+  if (fastParseFloat(s, end, out, stop)) {
+    return 1;
+  }
+  // rare: strtof needs a terminated copy
+  const char *p = s;
+  while (p < end && !isSpace(*p))
+    p++;
+  *stop = p;
+  size_t len = p - s;
+  char small[64];
+  char *copy = len < sizeof(small) ? small : (char *)malloc(len + 1);
+  assert(copy != NULL);
+  memcpy(copy, s, len);
+  copy[len] = '\0';
+  char *parsed;
+  *out = strtof(copy, &parsed);
+  int ok = parsed == copy + len;
+  if (copy != small) {
+    free(copy);
+  }
+  return ok;
+}
+
+// returns the offset of the first line of text starting at or after offset
+static size_t nextLine(const char *text, size_t size, size_t offset) {
+  while (offset < size && text[offset - 1] != '\n') {
+    offset++;
+  }
+  return offset < size ? offset : size;
+}
+
+// counts the fields in [p, end), where p starts a line; written as a
+// comparison of every byte with the one before it so it vectorizes
+static size_t countTokens(const char *p, const char *end) {
+  size_t len = end - p;
+  if (len == 0) {
+    return 0;
+  }
+  size_t n = !isSpace(p[0]);
+  for (size_t i = 1; i < len; i++) {
+    n += isSpace(p[i - 1]) & !isSpace(p[i]);
+  }
+  return n;
+}
+
+// parses the fields of c that belong to the first numFields sphere fields
+static void parseChunk(textChunk *c, size_t numFields, sphere *spheres) {
+  c->rejected = 0;
+  c->stop = NULL;
+  size_t token = c->firstToken;
+  size_t i = token / SPHERE_LINE_FIELDS;
+  int field = token % SPHERE_LINE_FIELDS;
+  const char *p = c->begin;
+  while (token < numFields) {
+    while (p < c->end && isSpace(*p))
+      p++;
+    if (p == c->end)
+      break;
+    float *dst = (float *)((char *)&spheres[i] + sphereLineFields[field]);
+    if (!parseFloatField(p, c->end, dst, &p)) {
+      c->rejected = 1;
+      break;
+    }
+    c->stop = p;
+    token++;
+    if (++field == SPHERE_LINE_FIELDS) {
+      field = 0;
+      i++;
+    }
+  }
+}
+
+// reads the bodies sphere lines at the position of fp by mapping its file and
+// parsing line-aligned chunks in parallel, leaving fp after the last one
+// returns 0 on success, or 1 with fp untouched if the file cannot be mapped
+// or holds a field the fast parser does not accept
+static int parseMappedSpheres(FILE *fp, sphere *spheres, int bodies) {
+  int fd = fileno(fp);
+  long start = ftell(fp);
+  struct stat st;
+  if (fd < 0 || start < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+      st.st_size <= start) {
+    return 1;
+  }
+  size_t size = st.st_size;
+  const char *text =
+      (const char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (text == MAP_FAILED) {
+    return 1;
+  }
+
+  size_t numChunks = (size - start + PARSE_CHUNK_BYTES - 1) / PARSE_CHUNK_BYTES;
+  textChunk *chunks = (textChunk *)malloc(numChunks * sizeof(textChunk));
+  assert(chunks != NULL);
+  cilk_for (size_t k = 0; k < numChunks; k++) {
+    size_t begin = start + k * PARSE_CHUNK_BYTES;
+    size_t end = begin + PARSE_CHUNK_BYTES;
+    chunks[k].begin = text + (k > 0 ? nextLine(text, size, begin) : begin);
+    chunks[k].end =
+        text + (k + 1 < numChunks ? nextLine(text, size, end) : size);
+    chunks[k].numTokens = countTokens(chunks[k].begin, chunks[k].end);
+  }
+
+  size_t numTokens = 0;
+  for (size_t k = 0; k < numChunks; k++) {
+    chunks[k].firstToken = numTokens;
+    numTokens += chunks[k].numTokens;
+  }
+
+  size_t numFields = (size_t)bodies * SPHERE_LINE_FIELDS;
+  cilk_for (size_t k = 0; k < numChunks; k++) {
+    if (chunks[k].firstToken < numFields) {
+      parseChunk(&chunks[k], numFields, spheres);
+    }
+  }
+
+  int complete = numTokens >= numFields;
+  const char *stop = NULL;
+  for (size_t k = 0; k < numChunks && chunks[k].firstToken < numFields; k++) {
+    complete &= !chunks[k].rejected;
+    if (chunks[k].stop != NULL) {
+      stop = chunks[k].stop;
+    }
+  }
+  long offset = complete ? stop - text : start;
+  free(chunks);
+  munmap((void *)text, size);
+
+  // fields fscanf reads differently, such as "1e" or two fields without a
+  // space between them, and malformed or missing spheres are left to it
+  fseek(fp, offset, SEEK_SET);
+  return complete ? 0 : 1;
+}
+
+// reads the bodies sphere lines at the position of fp one field at a time,
+// for streams that cannot be mapped
+// returns 0 on success, -1 if a sphere is malformed
+static int scanSpheres(FILE *fp, sphere *spheres, int bodies,
+                       const char *name) {
+  for (int i = 0; i < bodies; i++) {
+    int n = fscanf(fp, "%f%f%f%f%f%f%f%f%f%f%f%f", (float *)&spheres[i].r,
+                   (float *)&spheres[i].mass, (float *)&spheres[i].pos.x,
+                   (float *)&spheres[i].pos.y, (float *)&spheres[i].pos.z,
+                   (float *)&spheres[i].vel.x, (float *)&spheres[i].vel.y,
+                   (float *)&spheres[i].vel.z, &spheres[i].mat.diffuse.red,
+                   &spheres[i].mat.diffuse.green, &spheres[i].mat.diffuse.blue,
+                   &spheres[i].mat.reflection);
+    if (n != 12) {
+      printf("Sphere %d in %s is invalid.\n", i, name);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int loadScene(context *ctx, FILE *fp, const char *name) {
+  long numBodies;
+  if (fscanf(fp, "%lf%ld", &ctx->G, &numBodies) != 2 || numBodies <= 0 ||
+      numBodies > MAX_BODIES) {
+    printf("The scene in %s is invalid.\n", name);
+    return -1;
+  }
+  int bodies = (int)numBodies;
+  ctx->bodies = bodies;
+  ctx->numSpheres = bodies;
+  // zeroed: the first time step reads accelerations before setting them
+  size_t bytes = 2 * (size_t)bodies * sizeof(sphere);
+  sphere *spheres = (sphere *)bigAlloc(bytes);
+  if (spheres == NULL) {
+    printf("Could not allocate the %d spheres of %s.\n", bodies, name);
+    return -1;
+  }
+  firstTouch(spheres, bytes);
+  ctx->spheres = spheres;
+
+  if (parseMappedSpheres(fp, spheres, bodies) != 0 &&
+      scanSpheres(fp, spheres, bodies, name) != 0) {
+    return -1;
+  }
+
+  cilk_for (int i = 0; i < bodies; i++) {
+    spheres[i + bodies] = copySphere(spheres[i]);
+  }
+
+  // optional lights section: "lights K" followed by K lines of
+  // x y z red green blue [range]
+  int numSceneLights = 0;
+  light *lights = NULL;
+  if (fscanf(fp, " lights %d", &numSceneLights) == 1 && numSceneLights > 0) {
+    lights = (light *)malloc(numSceneLights * sizeof(light));
+    assert(lights != NULL);
+
+    char line[256];
+    int j = 0;
+    while (j < numSceneLights && fgets(line, sizeof(line), fp) != NULL) {
+      float x, y, z, red, green, blue, range = 0;
+      int n = sscanf(line, "%f%f%f%f%f%f%f", &x, &y, &z, &red, &green, &blue,
+                     &range);
+      if (n <= 0)
+        continue; // blank line
+      if (n < 6 || range < 0) {
+        printf("Light %d in %s is invalid.\n", j, name);
+        break;
+      }
+      lights[j] = newLight(newVector(x, y, z), newColor(red, green, blue));
+      lights[j].range = range;
+      j++;
+    }
+    numSceneLights = j;
+  }
+
+  setDefaultView(ctx);
+  ctx->lights = lights;
+  ctx->numSceneLights = numSceneLights;
+  setDefaultLights(ctx);
+  return 0;
+}
+
+// field layout of sphere and light this build reads and writes
+static void currentLayout(sceneHeader *h) {
+  h->sphereBytes = sizeof(sphere);
+  h->lightBytes = sizeof(light);
+  h->sphereFields[0] = offsetof(sphere, pos);
+  h->sphereFields[1] = offsetof(sphere, vel);
+  h->sphereFields[2] = offsetof(sphere, accel);
+  h->sphereFields[3] = offsetof(sphere, r);
+  h->sphereFields[4] = offsetof(sphere, mass);
+  h->sphereFields[5] = offsetof(sphere, mat);
+  h->byteOrder = SCENE_BYTE_ORDER;
+}
+
+// returns 1 if h describes a binary scene this build can map, else 0
+static int compatibleHeader(const sceneHeader *h) {
+  sceneHeader layout;
+  memset(&layout, 0, sizeof(layout));
+  currentLayout(&layout);
+  return memcmp(h->magic, SCENE_MAGIC, 4) == 0 &&
+         h->version == SCENE_VERSION &&
+         h->byteOrder == layout.byteOrder &&
+         h->sphereBytes == layout.sphereBytes &&
+         h->lightBytes == layout.lightBytes &&
+         memcmp(h->sphereFields, layout.sphereFields,
+                sizeof(layout.sphereFields)) == 0;
+}
+
+int isBinaryScene(FILE *fp) {
+  char magic[4];
+  int binary =
+      fread(magic, 1, 4, fp) == 4 && memcmp(magic, SCENE_MAGIC, 4) == 0;
+  rewind(fp);
+  return binary;
+}
+
+int mapScene(context *ctx, const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    printf("The file name you entered (%s) is invalid.\n", path);
+    return -1;
+  }
+
+  struct stat st;
+  sceneHeader h;
+  int valid = fstat(fd, &st) == 0 &&
+              pread(fd, &h, sizeof(h), 0) == (ssize_t)sizeof(h) &&
+              compatibleHeader(&h) && h.bodies > 0 && h.bodies <= MAX_BODIES;
+  if (valid) {
+    // offsets are checked before any sum, which a hostile header could wrap
+    uint64_t fileBytes = (uint64_t)st.st_size;
+    uint64_t sphereBytes = 2 * h.bodies * sizeof(sphere);
+    valid = h.sphereOffset % SCENE_ALIGNMENT == 0 &&
+            h.sphereOffset <= fileBytes &&
+            sphereBytes <= fileBytes - h.sphereOffset &&
+            h.lightOffset <= fileBytes &&
+            h.numLights <= (fileBytes - h.lightOffset) / sizeof(light) &&
+            h.numLights <= INT_MAX;
+  }
+  if (!valid) {
+    printf("The scene in %s is invalid or from another build.\n", path);
+    close(fd);
+    return -1;
+  }
+
+  // private and writable: the simulation steps the spheres in place, and
+  // the pages it writes become its own copies
+  void *map =
+      mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    printf("Could not map %s.\n", path);
+    return -1;
+  }
+  ctx->sceneMap = map;
+  ctx->sceneMapBytes = st.st_size;
+
+  ctx->G = h.G;
+  ctx->bodies = (int)h.bodies;
+  ctx->numSpheres = ctx->bodies;
+  ctx->spheres = (sphere *)((char *)map + h.sphereOffset);
+
+  ctx->numSceneLights = (int)h.numLights;
+  if (h.numLights > 0) {
+    ctx->lights = (light *)malloc(h.numLights * sizeof(light));
+    assert(ctx->lights != NULL);
+    memcpy(ctx->lights, (char *)map + h.lightOffset,
+           h.numLights * sizeof(light));
+  }
+  setDefaultLights(ctx);
+  if (h.numActiveLights <= h.numLights) {
+    ctx->numLights = (int)h.numActiveLights;
+  }
+
+  ctx->frame = h.frame <= INT_MAX ? (int)h.frame : 0;
+  ctx->e = h.view[0];
+  ctx->viewDirection = h.view[1];
+  ctx->w = h.view[2];
+  ctx->u = h.view[3];
+  ctx->v = h.view[4];
+  return 0;
+}
+
+// returns the padding that aligns offset to SCENE_ALIGNMENT
+static inline size_t alignPadding(size_t offset) {
+  return (SCENE_ALIGNMENT - offset % SCENE_ALIGNMENT) % SCENE_ALIGNMENT;
+}
+
+int saveScene(const context *ctx, const char *path) {
+  sceneHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, SCENE_MAGIC, 4);
+  h.version = SCENE_VERSION;
+  currentLayout(&h);
+  h.G = ctx->G;
+  h.bodies = ctx->bodies;
+  h.numLights = ctx->numSceneLights;
+  h.numActiveLights = ctx->numLights;
+  h.frame = ctx->frame;
+  h.view[0] = ctx->e;
+  h.view[1] = ctx->viewDirection;
+  h.view[2] = ctx->w;
+  h.view[3] = ctx->u;
+  h.view[4] = ctx->v;
+  h.sphereOffset = sizeof(h) + alignPadding(sizeof(h));
+  size_t sphereBytes = 2 * (size_t)ctx->bodies * sizeof(sphere);
+  h.lightOffset = h.sphereOffset + sphereBytes;
+
+  FILE *fp = fopen(path, "wb");
+  if (fp == NULL) {
+    printf("Could not write %s.\n", path);
+    return -1;
+  }
+  static const char zeros[SCENE_ALIGNMENT];
+  fwrite(&h, sizeof(h), 1, fp);
+  fwrite(zeros, 1, h.sphereOffset - sizeof(h), fp);
+  fwrite(ctx->spheres, 1, sphereBytes, fp);
+  fwrite(ctx->lights, sizeof(light), ctx->numSceneLights, fp);
+  int failed = ferror(fp);
+  failed |= fclose(fp) != 0;
+  if (failed) {
+    printf("Could not write %s.\n", path);
+    return -1;
+  }
+  return 0;
+}
+
+// spacing of the lattice of generated spheres, at least the largest
+// diameter plus twice the largest jitter
+#define LATTICE_SPACING 60
+#define LATTICE_JITTER 10
+
+// uniform in [0, 1) from the splitmix64 stream at *state
+static inline float nextUniform(uint64_t *state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  z ^= z >> 31;
+  return (z >> 40) * (1.0f / (1 << 24));
+}
+
+int generateScene(context *ctx, int bodies, unsigned seed) {
+  if (bodies <= 0 || bodies > MAX_BODIES) {
+    printf("Cannot generate a scene of %d bodies.\n", bodies);
+    return -1;
+  }
+  size_t bytes = 2 * (size_t)bodies * sizeof(sphere);
+  sphere *spheres = (sphere *)bigAlloc(bytes);
+  if (spheres == NULL) {
+    printf("Could not allocate the %d spheres.\n", bodies);
+    return -1;
+  }
+
+  ctx->G = 0.5;
+  ctx->bodies = ctx->numSpheres = bodies;
+  ctx->spheres = spheres;
+
+  // lattice cells along each axis; the block starts just in front of the
+  // camera and is centered on its line of sight
+  int side = (int)ceil(cbrt((double)bodies));
+  float extent = (float)side * LATTICE_SPACING;
+  cilk_for (int i = 0; i < bodies; i++) {
+    // one stream per sphere, so the scene does not depend on the workers
+    uint64_t state = (uint64_t)seed << 32 ^ (uint64_t)i;
+    int cx = i % side, cy = i / side % side, cz = i / side / side;
+    sphere s;
+    memset(&s, 0, sizeof(s));
+    s.r = 10 + 9 * nextUniform(&state);
+    s.mass = 100 + 400 * nextUniform(&state);
+    s.pos = newVector(
+        -cx * LATTICE_SPACING + LATTICE_JITTER * (2 * nextUniform(&state) - 1),
+        100 + (cy + 0.5f) * LATTICE_SPACING - extent / 2 +
+            LATTICE_JITTER * (2 * nextUniform(&state) - 1),
+        (cz + 0.5f) * LATTICE_SPACING - extent / 2 +
+            LATTICE_JITTER * (2 * nextUniform(&state) - 1));
+    s.vel = newVector(2 * nextUniform(&state) - 1, 2 * nextUniform(&state) - 1,
+                      2 * nextUniform(&state) - 1);
+    s.mat = newMaterial(newColor(nextUniform(&state), nextUniform(&state),
+                                 nextUniform(&state)),
+                        nextUniform(&state));
+    spheres[i] = s;
+    spheres[i + bodies] = s;
+  }
+
+  setDefaultView(ctx);
+  setDefaultLights(ctx);
+  return 0;
+}
+
+int sceneReadHeader(const char *path, double *G, long *bodies) {
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL)
+    return -1;
+
+  int found;
+  if (isBinaryScene(fp)) {
+    sceneHeader h;
+    found = fread(&h, sizeof(h), 1, fp) == 1 && compatibleHeader(&h);
+    if (found) {
+      *G = h.G;
+      *bodies = (long)h.bodies;
+    }
+  } else {
+    found = fscanf(fp, "%lf%ld", G, bodies) == 2;
+  }
+  fclose(fp);
+  return found ? 0 : -1;
+}
@@ -0,0 +1,69 @@
+/**
+ * Scene files: the text format and a binary format mapped in place
+ **/
+
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "context.h"
+
+#define SCENE_MAGIC "PSCN"
+#define SCENE_VERSION 2
+#define SCENE_BYTE_ORDER 0x01020304
+#define SCENE_ALIGNMENT 64
+
+// Header of a binary scene file. It is followed, at sphereOffset, by the
+// 2 * bodies spheres of the simulation arrays (current then next state, as
+// laid out in memory), and at lightOffset by numLights lights. A file is
+// only read by builds with the same byte order and field layout. Together
+// with the frame and camera it holds the whole state of a run, so the same
+// format serves as a checkpoint.
+typedef struct {
+  char magic[4]; // SCENE_MAGIC
+  uint32_t version;
+  uint32_t byteOrder; // SCENE_BYTE_ORDER as written
+  uint32_t sphereBytes, lightBytes;
+  uint32_t sphereFields[6]; // offsets of pos, vel, accel, r, mass, mat
+  uint32_t numLights;
+  uint32_t numActiveLights; // lights switched on, at most numLights
+  double G;
+  uint64_t bodies;
+  uint64_t sphereOffset, lightOffset;
+  uint64_t frame;  // frames simulated before the spheres were saved
+  vector view[5]; // e, viewDirection, w, u, v
+} sceneHeader;
+
+// reads the scene text in fp (named name in messages) into the spheres,
+// lights and camera of ctx, leaving its image and renderer caches alone
+// returns 0 on success, -1 if the scene is malformed
+int loadScene(context *ctx, FILE *fp, const char *name);
+
+// returns 1 if fp, which is left at its start, holds a binary scene
+int isBinaryScene(FILE *fp);
+
+// maps the binary scene at path into the spheres, lights, camera and frame
+// of ctx; the spheres point straight into the private mapping, so nothing is
+// parsed or copied up front
+// returns 0 on success, -1 if the file is malformed or from another build
+int mapScene(context *ctx, const char *path);
+
+// writes the spheres, lights, camera and frame of ctx as a binary scene
+// returns 0 on success, -1 on failure
+int saveScene(const context *ctx, const char *path);
+
+// fills ctx with a scene of bodies spheres drawn from seed: a jittered
+// lattice of non-overlapping spheres with the sizes, masses and G of the
+// tier scenes, in front of the default camera and lit by the default lights;
+// the lattice grows with the cube root of bodies, so the density stays that
+// of a small scene
+// returns 0 on success, -1 if bodies is out of range or memory runs out
+int generateScene(context *ctx, int bodies, unsigned seed);
+
+// reads G and the body count of the text or binary scene at path
+// returns 0 on success, -1 on failure
+int sceneReadHeader(const char *path, double *G, long *bodies);
+
+#endif
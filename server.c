@@ -0,0 +1,237 @@
+/**
+ * Render daemon serving scene submissions over a local UNIX socket
+ **/
+
+#include <assert.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "scene.h"
+#include "server.h"
+#include "utils/fasttime.h"
+
+#define MAX_IMAGE_SIDE 16384
+
+// One RENDER request
+typedef struct {
+  int frames;
+  int height, width;
+  int sendFrames;  // 0 for timing only
+  int inlineBytes; // size of the scene text that follows, -1 for a file
+  char path[SERVER_MAX_LINE];
+} renderJob;
+
+// scene of the last job; its image and renderer caches outlive the job, so
+// that a job of the same size allocates nothing and reuses the cached rays
+static context warm;
+static size_t imgCapacity;
+
+// returns 1 and fills job if line is a well-formed RENDER request, else 0
+static int parseRequest(const char *line, renderJob *job) {
+  char reply[16], source[16];
+  int consumed = 0;
+  if (sscanf(line, "RENDER %d %d %d %15s %15s %n", &job->frames,
+             &job->height, &job->width, reply, source, &consumed) != 5 ||
+      consumed == 0) {
+    return 0;
+  }
+  if (job->frames <= 0 || job->height <= 0 || job->width <= 0 ||
+      job->height > MAX_IMAGE_SIDE || job->width > MAX_IMAGE_SIDE) {
+    return 0;
+  }
+
+  if (strcmp(reply, "frames") == 0) {
+    job->sendFrames = 1;
+  } else if (strcmp(reply, "timing") == 0) {
+    job->sendFrames = 0;
+  } else {
+    return 0;
+  }
+
+  const char *arg = line + consumed;
+  job->path[0] = '\0';
+  job->inlineBytes = -1;
+  if (strcmp(source, "file") == 0) {
+    snprintf(job->path, sizeof(job->path), "%s", arg);
+    return job->path[0] != '\0';
+  }
+  if (strcmp(source, "inline") == 0) {
+    return sscanf(arg, "%d", &job->inlineBytes) == 1 && job->inlineBytes > 0;
+  }
+  return 0;
+}
+
+// replaces the scene of warm by the one job names, reading inline scene text
+// from in; the image and renderer caches of warm are left alone
+// returns 0 on success, -1 on failure
+static int loadJobScene(FILE *in, const renderJob *job) {
+  char *text = NULL;
+  FILE *fp;
+  if (job->inlineBytes > 0) {
+    text = (char *)malloc(job->inlineBytes);
+    if (text == NULL ||
+        fread(text, 1, job->inlineBytes, in) != (size_t)job->inlineBytes) {
+      free(text);
+      return -1;
+    }
+    fp = fmemopen(text, job->inlineBytes, "r");
+  } else {
+    fp = fopen(job->path, "r");
+  }
+  if (fp == NULL) {
+    free(text);
+    return -1;
+  }
+
+  freeScene(&warm);
+  // binary scenes are mapped from their file, inline scenes are text
+  int status = text == NULL && isBinaryScene(fp)
+                   ? mapScene(&warm, job->path)
+                   : loadScene(&warm, fp, text ? "inline scene" : job->path);
+  fclose(fp);
+  free(text);
+  return status;
+}
+
+// simulates and renders the frames of job, streaming them to out
+// returns 0 and sets *msec to the time taken, or -1 if the client went away
+static int runJob(FILE *out, const renderJob *job, uint32_t *msec) {
+  int height = job->height, width = job->width;
+  size_t bytes = framebufferBytes(framebufferFormat, height, width);
+  if (bytes > imgCapacity) {
+    framebufferFree(warm.img);
+    warm.img = framebufferAlloc(framebufferFormat, height, width);
+    assert(warm.img != NULL);
+    imgCapacity = bytes;
+  }
+  warm.height = height;
+  warm.width = width;
+
+  fprintf(out, "OK %d %d %d %s\n", warm.numSpheres, height, width,
+          framebufferFormatName(framebufferFormat));
+
+  fasttime_t start = gettime();
+  for (int f = 1; f <= job->frames && !ferror(out); f++) {
+    fasttime_t simStart = gettime();
+    simulate(&warm);
+    sort(&warm);
+    fasttime_t renderStart = gettime();
+    render(&warm, warm.img, height, width, warm.e, warm.u, warm.v,
+           warm.numLights, warm.lights);
+    fasttime_t renderStop = gettime();
+
+    fprintf(out, "FRAME %d %zu %llu %llu\n", f, job->sendFrames ? bytes : 0,
+            (unsigned long long)tdiff_nsec(simStart, renderStart) / 1000,
+            (unsigned long long)tdiff_nsec(renderStart, renderStop) / 1000);
+    if (job->sendFrames) {
+      fwrite(warm.img, 1, bytes, out);
+    }
+    fflush(out);
+  }
+  *msec = tdiff_msec(start, gettime());
+
+  fprintf(out, "DONE %u\n", *msec);
+  fflush(out);
+  return ferror(out) ? -1 : 0;
+}
+
+// answers the requests of one client until it hangs up or errs
+// returns 1 if the client asked for a shutdown, else 0
+static int serveClient(int fd, int *numJobs) {
+  FILE *in = fdopen(fd, "r");
+  FILE *out = fdopen(dup(fd), "w");
+  assert(in != NULL && out != NULL);
+
+  int stop = 0;
+  char line[SERVER_MAX_LINE];
+  while (fgets(line, sizeof(line), in) != NULL) {
+    size_t len = strcspn(line, "\n");
+    if (line[len] != '\n') {
+      fprintf(out, "ERR request too long\n");
+      break;
+    }
+    line[len] = '\0';
+
+    if (strcmp(line, "SHUTDOWN") == 0) {
+      fprintf(out, "BYE\n");
+      stop = 1;
+      break;
+    }
+
+    renderJob job;
+    if (!parseRequest(line, &job)) {
+      fprintf(out, "ERR malformed request\n");
+      break;
+    }
+    if (loadJobScene(in, &job) != 0) {
+      fprintf(out, "ERR cannot load scene\n");
+      break;
+    }
+
+    uint32_t msec;
+    int failed = runJob(out, &job, &msec) != 0;
+    (*numJobs)++;
+    printf("Job %d: %d spheres, %d frames of %dx%d in %u ms%s\n", *numJobs,
+           warm.numSpheres, job.frames, job.height, job.width, msec,
+           failed ? " (client gone)" : "");
+    fflush(stdout);
+    if (failed)
+      break;
+  }
+
+  fclose(in);
+  fclose(out);
+  return stop;
+}
+
+int runServer(const char *path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    printf("The socket path you entered (%s) is too long.\n", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0) {
+    printf("Could not create a socket.\n");
+    return -1;
+  }
+  unlink(path); // left behind by an earlier daemon
+  if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(listener, 8) != 0) {
+    printf("Could not listen on %s.\n", path);
+    close(listener);
+    return -1;
+  }
+
+  // a client hanging up mid-frame must not take the daemon down
+  signal(SIGPIPE, SIG_IGN);
+  printf("Listening on %s\n", path);
+  fflush(stdout);
+
+  int numJobs = 0;
+  int stop = 0;
+  while (!stop) {
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0)
+      continue;
+    stop = serveClient(fd, &numJobs);
+  }
+
+  close(listener);
+  unlink(path);
+  freeContext(&warm);
+  imgCapacity = 0;
+  printf("Served %d jobs\n", numJobs);
+  return 0;
+}
@@ -0,0 +1,28 @@
+/**
+ * Render daemon serving scene submissions over a local UNIX socket
+ **/
+
+#ifndef SERVER_H
+#define SERVER_H
+
+// Requests are one line each:
+//   RENDER frames height width frames|timing file PATH
+//   RENDER frames height width frames|timing inline BYTES, then BYTES bytes
+//   of scene text
+//   SHUTDOWN
+// and are answered with "ERR message", or with
+//   OK numSpheres height width format
+//   FRAME frame bytes simulateUsec renderUsec, then bytes bytes of image
+//   laid out as format (no image bytes with timing), once per frame
+//   DONE elapsedMsec
+
+// Longest request line, in bytes
+#define SERVER_MAX_LINE 4096
+
+// serves requests on the UNIX socket at path, one client at a time, keeping
+// the framebuffer and renderer caches of the last job for the next one
+// returns 0 once a client asks for a shutdown, -1 if the socket cannot be
+// set up
+int runServer(const char *path);
+
+#endif
@@ -10,31 +10,100 @@
 #include <string.h>
 #include <time.h>
 
-#include "render.h"
-#include "simulate.h"
-
-double G;
-int bodies, numSpheres;
-sphere *spheres;
-
-void sort(sphere *spheres, int n, vector e) {
-  sphere key, copyKey;
-  for (int i = 1; i < n; i++) {
-    key = copySphere(spheres[i]);
-    copyKey = copySphere(spheres[i + bodies]);
-    int j = i - 1;
-
-    while (j >= 0 && qdist(spheres[j].pos, e) > qdist(key.pos, e)) {
-      spheres[j + 1] = copySphere(spheres[j]);
-      spheres[j + bodies + 1] = copySphere(spheres[j + bodies]);
-      j = j - 1;
+#include "context.h"
+#include "stats.h"
+
+// Distance of sphere index from the eye, the key sort() orders by
+typedef struct {
+  float dist;
+  int index;
+} sortKey;
+
+// runs below this many keys are sorted by insertion
+#define SORT_SERIAL 32
+
+// sorts keys[0..n) by dist, keeping the order of equal keys, using
+// tmp[0..n) as scratch; halves that are already in order are not merged,
+// so the nearly sorted keys of consecutive frames cost about linear time
+static void sortKeys(sortKey *keys, sortKey *tmp, int n) {
+  if (n <= SORT_SERIAL) {
+    for (int i = 1; i < n; i++) {
+      sortKey key = keys[i];
+      int j = i - 1;
+      while (j >= 0 && keys[j].dist > key.dist) {
+        keys[j + 1] = keys[j];
+        j = j - 1;
+      }
+      keys[j + 1] = key;
+    }
+    return;
+  }
+
+  int half = n / 2;
+  cilk_spawn sortKeys(keys, tmp, half);
+  sortKeys(keys + half, tmp + half, n - half);
+  cilk_sync;
+  if (keys[half - 1].dist <= keys[half].dist)
+    return;
+
+  // ties go to the left half, which keeps the sort stable
+  int i = 0, j = half, k = 0;
+  while (i < half && j < n) {
+    tmp[k++] = keys[j].dist < keys[i].dist ? keys[j++] : keys[i++];
+  }
+  while (i < half) {
+    tmp[k++] = keys[i++];
+  }
+  while (j < n) {
+    tmp[k++] = keys[j++];
+  }
+  memcpy(keys, tmp, n * sizeof(sortKey));
+}
+
+// orders the first numSpheres spheres of both halves of ctx by distance from
+// its eye; a stable merge sort, so the order is that of an insertion sort
+void sort(context *ctx) {
+  sphere *spheres = ctx->spheres;
+  int bodies = ctx->bodies, n = ctx->numSpheres;
+  vector e = ctx->e;
+  if (n <= 1)
+    return;
+
+  if ((size_t)n > ctx->sortCapacity) {
+    free(ctx->sortKeys);
+    free(ctx->sortMoved);
+    ctx->sortCapacity = n;
+    ctx->sortKeys = malloc(2 * (size_t)n * sizeof(sortKey));
+    ctx->sortMoved = (sphere *)malloc((size_t)n * sizeof(sphere));
+    assert(ctx->sortKeys != NULL && ctx->sortMoved != NULL);
+  }
+  sortKey *keys = (sortKey *)ctx->sortKeys;
+  sphere *moved = ctx->sortMoved;
+  cilk_for (int i = 0; i < n; i++) {
+    keys[i].dist = qdist(spheres[i].pos, e);
+    keys[i].index = i;
+  }
+  sortKeys(keys, keys + n, n);
+
+  int first = 0;
+  while (first < n && keys[first].index == first) {
+    first++;
+  }
+
+  // both halves follow the permutation of the current one
+  for (int h = 0; h < 2 && first < n; h++) {
+    sphere *half = spheres + h * (size_t)bodies;
+    cilk_for (int i = first; i < n; i++) {
+      moved[i] = copySphere(half[keys[i].index]);
     }
-    spheres[j + 1] = key;
-    spheres[j + bodies + 1] = copyKey;
+    memcpy(half + first, moved + first, (size_t)(n - first) * sizeof(sphere));
   }
 }
 
-void updateAccelSphere(int i) {
+void updateAccelSphere(context *ctx, int i) {
+  sphere *spheres = ctx->spheres;
+  int bodies = ctx->bodies;
+  double G = ctx->G;
   double rx = 0;
   double ry = 0;
   double rz = 0;
@@ -54,19 +123,23 @@ void updateAccelSphere(int i) {
   spheres[i + bodies].accel = newVector((float)rx, (float)ry, (float)rz);
 }
 
-void updateAccelerations() {
-  for (int i = 0; i < bodies; i++) {
-    updateAccelSphere(i);
+void updateAccelerations(context *ctx) {
+  for (int i = 0; i < ctx->bodies; i++) {
+    updateAccelSphere(ctx, i);
   }
 }
 
-void updateVelocities(float t) {
+void updateVelocities(context *ctx, float t) {
+  sphere *spheres = ctx->spheres;
+  int bodies = ctx->bodies;
   for (int i = 0; i < bodies; i++) {
     spheres[i + bodies].vel = qadd(spheres[i].vel, scale(t, spheres[i].accel));
   }
 }
 
-void updatePositions(float t) {
+void updatePositions(context *ctx, float t) {
+  sphere *spheres = ctx->spheres;
+  int bodies = ctx->bodies;
   for (int i = 0; i < bodies; i++) {
     spheres[i + bodies].pos = qadd(spheres[i].pos, scale(t, spheres[i].vel));
   }
@@ -74,10 +147,14 @@ void updatePositions(float t) {
 
 // runs simulation for minCollisionTime timesteps
 // perform collision between spheres at indices i and j
-void doMiniStepWithCollisions(float minCollisionTime, int i, int j) {
-  updateAccelerations();
-  updateVelocities(minCollisionTime);
-  updatePositions(minCollisionTime);
+void doMiniStepWithCollisions(context *ctx, float minCollisionTime, int i,
+                              int j) {
+  sphere *spheres = ctx->spheres;
+  int bodies = ctx->bodies;
+  STAT_ADD(STAT_MINI_STEPS, 1);
+  updateAccelerations(ctx);
+  updateVelocities(ctx, minCollisionTime);
+  updatePositions(ctx, minCollisionTime);
 
   for (int k = 0; k < bodies; k++) {
     spheres[k] = copySphere(spheres[k + bodies]);
@@ -86,6 +163,7 @@ void doMiniStepWithCollisions(float minCollisionTime, int i, int j) {
   if (i == -1 || j == -1) {
     return;
   }
+  STAT_ADD(STAT_COLLISIONS_RESOLVED, 1);
 
   vector distVec = qsubtract(spheres[i].pos, spheres[j].pos);
   float scale1 = 2 * spheres[j].mass /
@@ -103,7 +181,9 @@ void doMiniStepWithCollisions(float minCollisionTime, int i, int j) {
 // timeLeft timesteps
 // modifies mag to contain the frame-of-reference-adjusted velocity
 // of sphere j in sphere i's frame of reference
-int checkForCollision(int i, int j, float timeLeft, float *mag) {
+int checkForCollision(context *ctx, int i, int j, float timeLeft, float *mag) {
+  const sphere *spheres = ctx->spheres;
+  STAT_ADD(STAT_PAIR_CHECKS, 1);
   vector distVec = qsubtract(spheres[i].pos, spheres[j].pos);
   float dist = qsize(distVec);
   float sumRadii = (float)((double)spheres[i].r + (double)spheres[j].r);
@@ -120,6 +200,7 @@ int checkForCollision(int i, int j, float timeLeft, float *mag) {
       (movevec.x == 0 && movevec.y == 0 && movevec.z == 0)) {
     return 0;
   }
+  STAT_ADD(STAT_PAST_REACH, 1);
 
   vector unitMovevec = scale(1 / qsize(movevec), movevec);
 
@@ -130,6 +211,7 @@ int checkForCollision(int i, int j, float timeLeft, float *mag) {
   if (distAlongMovevec <= 0) {
     return 0;
   }
+  STAT_ADD(STAT_PAST_APPROACH, 1);
 
   float jToMovevecDistSq =
       (float)((double)(dist * dist) -
@@ -141,6 +223,7 @@ int checkForCollision(int i, int j, float timeLeft, float *mag) {
   if (jToMovevecDistSq >= sumRadiiSquared) {
     return 0;
   }
+  STAT_ADD(STAT_PAST_CLOSEST, 1);
 
   // We now have jToMovevecDistSq and sumRadii, two sides of a right triangle.
   // Use these to find the third side, sqrt(T)
@@ -160,56 +243,69 @@ int checkForCollision(int i, int j, float timeLeft, float *mag) {
     return 0;
   }
 
+  STAT_ADD(STAT_COLLISIONS_FOUND, 1);
   return 1;
 }
 
-void newDoTimeStep(float timeStep) {
+void newDoTimeStep(context *ctx, float timeStep) {
   // TODO: delete this call to doTimeStep and write your own, optimized code!
-  doTimeStep(timeStep);
+  doTimeStep(ctx, timeStep);
 }
 
-void doTimeStep(float timeStep) {
+float findFirstCollision(context *ctx, float timeLeft, int *collider1,
+                         int *collider2) {
+  const sphere *spheres = ctx->spheres;
+  int bodies = ctx->bodies;
+  float minCollisionTime = timeLeft;
+  *collider1 = -1;
+  *collider2 = -1;
+
+  for (int i = 0; i < bodies; i++) {
+    for (int j = i + 1; j < bodies; j++) {
+      float refFrameAdjustedVelMag;
+      if (checkForCollision(ctx, i, j, timeLeft, &refFrameAdjustedVelMag)) {
+        // Set the time step so that the spheres will just touch
+        vector movevec =
+            qadd(spheres[j].vel, scale(0.5 * timeLeft, spheres[j].accel));
+        float touchTimePct = timeLeft * qsize(movevec) / refFrameAdjustedVelMag;
+
+        if (touchTimePct > 1) {
+          touchTimePct = 1 / touchTimePct;
+        }
+
+        if ((touchTimePct * timeLeft) < minCollisionTime) {
+          minCollisionTime = touchTimePct * timeLeft;
+          *collider1 = i;
+          *collider2 = j;
+        }
+      }
+    }
+  }
+  return minCollisionTime;
+}
+
+void doTimeStep(context *ctx, float timeStep) {
   float timeLeft = timeStep;
 
   // If collisions are getting too frequent, we cut time step early
   // This allows for smoother rendering without losing accuracy
   while (timeLeft > 0.000001) {
-    float minCollisionTime = timeLeft;
-    int indexCollider1 = -1;
-    int indexCollider2 = -1;
-
-    for (int i = 0; i < bodies; i++) {
-      for (int j = i + 1; j < bodies; j++) {
-        float refFrameAdjustedVelMag;
-        if (checkForCollision(i, j, timeLeft, &refFrameAdjustedVelMag)) {
-          // Set the time step so that the spheres will just touch
-          vector movevec =
-              qadd(spheres[j].vel, scale(0.5 * timeLeft, spheres[j].accel));
-          float touchTimePct =
-              timeLeft * qsize(movevec) / refFrameAdjustedVelMag;
-
-          if (touchTimePct > 1) {
-            touchTimePct = 1 / touchTimePct;
-          }
-
-          if ((touchTimePct * timeLeft) < minCollisionTime) {
-            minCollisionTime = touchTimePct * timeLeft;
-            indexCollider1 = i;
-            indexCollider2 = j;
-          }
-        }
-      }
-    }
+    int indexCollider1, indexCollider2;
+    float minCollisionTime =
+        findFirstCollision(ctx, timeLeft, &indexCollider1, &indexCollider2);
 
-    doMiniStepWithCollisions(minCollisionTime, indexCollider1, indexCollider2);
+    doMiniStepWithCollisions(ctx, minCollisionTime, indexCollider1,
+                             indexCollider2);
 
     timeLeft = timeLeft - minCollisionTime;
   }
 }
 
-void simulateOrig() { doTimeStep(1 / log(bodies)); }
+float simulationStep(const context *ctx) { return 1 / log(ctx->bodies); }
+
+void simulateOrig(context *ctx) { doTimeStep(ctx, simulationStep(ctx)); }
 
-void simulate() {
+void simulate(context *ctx) {
   // TODO: delete this call to simulateOrig and write your own, optimized code!
-  simulateOrig();
+  simulateOrig(ctx);
 }
@@ -32,9 +32,12 @@ typedef struct {
   vector dir;
 } ray;
 
+// A point light; it reaches only points within range of it, or every point
+// when range is 0
 typedef struct {
   vector pos;
   color intensity;
+  float range;
 } light;
 
 static inline vector newVector(float x, float y, float z) {
@@ -105,6 +108,7 @@ static inline light newLight(vector pos, color intensity) {
   light l;
   l.pos = pos;
   l.intensity = intensity;
+  l.range = 0;
   return l;
 }
 
@@ -171,31 +175,40 @@ static inline int equals(vector v1, vector v2) {
   return 1;
 }
 
-// bodies info, defined in simulate.c
-extern double G;
-extern int bodies, numSpheres;
-extern sphere *spheres;
+// state of one scene, defined in context.h
+typedef struct context context;
 
-void updateAccelSphere(int i);
+void updateAccelSphere(context *ctx, int i);
 
-void updateAccelerations();
+void updateAccelerations(context *ctx);
 
-void updateVelocities(float t);
+void updateVelocities(context *ctx, float t);
 
-void updatePositions(float t);
+void updatePositions(context *ctx, float t);
 
-void doMiniStepWithCollisions(float minCollisionTime, int i, int j);
+void doMiniStepWithCollisions(context *ctx, float minCollisionTime, int i,
+                              int j);
 
-int checkForCollision(int i, int j, float timeLeft, float *mag);
+int checkForCollision(context *ctx, int i, int j, float timeLeft, float *mag);
 
-void sort(sphere *spheres, int n, vector e);
+// sorts the first numSpheres spheres of ctx by distance from its eye
+void sort(context *ctx);
 
-void doTimeStep(float timeStep);
+// scans every pair of spheres for the first collision in the next timeLeft
+// sets *collider1 and *collider2 to the pair, or both to -1 if there is none
+// returns the time until that collision, or timeLeft if there is none
+float findFirstCollision(context *ctx, float timeLeft, int *collider1,
+                         int *collider2);
 
-void newDoTimeStep(float timeStep);
+void doTimeStep(context *ctx, float timeStep);
 
-void simulateOrig();
+void newDoTimeStep(context *ctx, float timeStep);
 
-void simulate();
+// length of the time step simulate() advances ctx by
+float simulationStep(const context *ctx);
+
+void simulateOrig(context *ctx);
+
+void simulate(context *ctx);
 
 #endif
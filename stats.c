@@ -0,0 +1,89 @@
+/**
+ * Event counters of the simulation and render hot paths, per frame
+ **/
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+
+#if STATS
+static const char *const statNames[NUM_STATS] = {
+    "mini_steps",
+    "pair_checks",
+    "past_reach",
+    "past_approach",
+    "past_closest",
+    "collisions_found",
+    "collisions_resolved",
+    "ray_tests",
+    "ray_hits",
+    "lights_shaded",
+};
+
+_Thread_local statBlock *localStats;
+
+// every block ever registered; blocks live as long as the process, since
+// workers keep theirs until they exit
+static statBlock *allStats;
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+
+statBlock *registerStats(void) {
+  statBlock *b = (statBlock *)aligned_alloc(64, sizeof(statBlock));
+  assert(b != NULL);
+  memset(b, 0, sizeof(statBlock));
+  pthread_mutex_lock(&statsLock);
+  b->next = allStats;
+  allStats = b;
+  pthread_mutex_unlock(&statsLock);
+  localStats = b;
+  return b;
+}
+
+// sums the counters of every worker into totals and zeroes them
+static void collectStats(uint64_t *totals) {
+  memset(totals, 0, NUM_STATS * sizeof(uint64_t));
+  pthread_mutex_lock(&statsLock);
+  for (statBlock *b = allStats; b != NULL; b = b->next) {
+    for (int c = 0; c < NUM_STATS; c++) {
+      totals[c] += b->count[c];
+      b->count[c] = 0;
+    }
+  }
+  pthread_mutex_unlock(&statsLock);
+}
+#endif
+
+FILE *statsOpen(const char *path) {
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) {
+    printf("Could not write %s.\n", path);
+    return NULL;
+  }
+  fprintf(fp, "frame,simulate_ms,sort_ms,render_ms");
+#if STATS
+  for (int c = 0; c < NUM_STATS; c++) {
+    fprintf(fp, ",%s", statNames[c]);
+  }
+  // counts before the first frame, such as loading, are not part of it
+  uint64_t totals[NUM_STATS];
+  collectStats(totals);
+#endif
+  fprintf(fp, "\n");
+  return fp;
+}
+
+void statsWriteFrame(FILE *fp, int frame, double simulateMs, double sortMs,
+                     double renderMs) {
+  fprintf(fp, "%d,%.3f,%.3f,%.3f", frame, simulateMs, sortMs, renderMs);
+#if STATS
+  uint64_t totals[NUM_STATS];
+  collectStats(totals);
+  for (int c = 0; c < NUM_STATS; c++) {
+    fprintf(fp, ",%llu", (unsigned long long)totals[c]);
+  }
+#endif
+  fprintf(fp, "\n");
+}
@@ -0,0 +1,60 @@
+/**
+ * Event counters of the simulation and render hot paths, per frame
+ **/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum {
+  STAT_MINI_STEPS,          // doMiniStepWithCollisions() calls
+  STAT_PAIR_CHECKS,         // checkForCollision() calls
+  STAT_PAST_REACH,          // ...that move far enough to touch
+  STAT_PAST_APPROACH,       // ...and towards each other
+  STAT_PAST_CLOSEST,        // ...and pass closer than their radii
+  STAT_COLLISIONS_FOUND,    // ...and touch within the time left
+  STAT_COLLISIONS_RESOLVED, // mini-steps ending in a collision
+  STAT_RAY_TESTS,           // primary ray against sphere tests
+  STAT_RAY_HITS,            // primary rays that hit a sphere
+  STAT_LIGHTS_SHADED,       // lights that lit a hit
+  NUM_STATS
+} statCounter;
+
+#if STATS
+// counters of one worker thread, on cache lines of their own
+typedef struct statBlock {
+  uint64_t count[NUM_STATS];
+  struct statBlock *next;
+} __attribute__((aligned(64))) statBlock;
+
+extern _Thread_local statBlock *localStats;
+
+// allocates the counters of the calling thread
+statBlock *registerStats(void);
+
+static inline void statAdd(statCounter c, uint64_t n) {
+  statBlock *b = localStats;
+  if (b == NULL)
+    b = registerStats();
+  b->count[c] += n;
+}
+
+#define STAT_ADD(c, n) statAdd(c, n)
+#else
+// counting is compiled in only by 'make STATS=1'
+#define STAT_ADD(c, n) ((void)0)
+#endif
+
+// opens path and writes the header of a CSV file with one row per frame: its
+// simulate, sort and render times and, in STATS=1 builds, its counters
+// returns the file, or NULL if it cannot be written
+FILE *statsOpen(const char *path);
+
+// writes the row of frame number frame, with the counts since the last row;
+// must not run while any worker may be counting
+void statsWriteFrame(FILE *fp, int frame, double simulateMs, double sortMs,
+                     double renderMs);
+
+#endif
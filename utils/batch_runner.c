@@ -0,0 +1,121 @@
+/**
+ * Batch runner simulating and rendering many scenes at once, one context each
+ **/
+
+#include <assert.h>
+#include <cilk/cilk.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../main.h"
+#include "./fasttime.h"
+
+static int compareNames(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// returns 1 if name ends in ".txt"
+static int isSceneFile(const char *name) {
+  size_t len = strlen(name);
+  return len > 4 && strcmp(name + len - 4, ".txt") == 0;
+}
+
+// lists the scene files of dir, sorted by name, into *paths
+// returns the number of scene files, or -1 if dir cannot be read
+static int listScenes(const char *dir, char ***paths) {
+  DIR *d = opendir(dir);
+  if (d == NULL) {
+    return -1;
+  }
+
+  int count = 0, capacity = 0;
+  char **names = NULL;
+  struct dirent *entry;
+  while ((entry = readdir(d)) != NULL) {
+    if (!isSceneFile(entry->d_name))
+      continue;
+    if (count == capacity) {
+      capacity = capacity ? 2 * capacity : 16;
+      names = (char **)realloc(names, capacity * sizeof(char *));
+      assert(names != NULL);
+    }
+    size_t len = strlen(dir) + strlen(entry->d_name) + 2;
+    names[count] = (char *)malloc(len);
+    assert(names[count] != NULL);
+    snprintf(names[count], len, "%s/%s", dir, entry->d_name);
+    count++;
+  }
+  closedir(d);
+
+  qsort(names, count, sizeof(char *), compareNames);
+  *paths = names;
+  return count;
+}
+
+int runBatch(const char *dir, int nFrames) {
+  char **paths;
+  int numScenes = listScenes(dir, &paths);
+  if (numScenes < 0) {
+    printf("The directory you entered (%s) is invalid.\n", dir);
+    return -1;
+  }
+  if (numScenes == 0) {
+    printf("No scene files (*.txt) in %s.\n", dir);
+    free(paths);
+    return -1;
+  }
+
+  // each scene owns its simulation, image and renderer caches, so the
+  // scenes share nothing but the read-only render options
+  context *scenes = (context *)calloc(numScenes, sizeof(context));
+  int *failed = (int *)calloc(numScenes, sizeof(int));
+  assert(scenes != NULL && failed != NULL);
+
+  fasttime_t start = gettime();
+  cilk_for (int k = 0; k < numScenes; k++) {
+    context *ctx = &scenes[k];
+    if (init(ctx, paths[k], HEIGHT, WIDTH) != 0) {
+      failed[k] = 1;
+      continue;
+    }
+    for (int f = 0; f < nFrames; f++) {
+      simulate(ctx);
+      sort(ctx);
+      render(ctx, ctx->img, HEIGHT, WIDTH, ctx->e, ctx->u, ctx->v,
+             ctx->numLights, ctx->lights);
+    }
+  }
+  fasttime_t stop = gettime();
+
+  int numDone = 0;
+  long long pixelsTraced = 0, pixelsTotal = 0;
+  for (int k = 0; k < numScenes; k++) {
+    if (!failed[k]) {
+      numDone++;
+      pixelsTraced += scenes[k].cache.totals.pixelsTraced;
+      pixelsTotal += scenes[k].cache.totals.pixelsTotal;
+    }
+    // scenes that failed partway through init() still hold what it allocated
+    freeContext(&scenes[k]);
+    free(paths[k]);
+  }
+  free(paths);
+  free(scenes);
+  free(failed);
+
+  uint32_t time = tdiff_msec(start, stop);
+  double elapsed = tdiff_sec(start, stop);
+  printf("Num scenes: %d of %d\nImg size: %dx%d\nNum frames: %d per scene\n"
+         "---- RESULTS ----\nTime elapsed: %u ms\nThroughput: %.1f "
+         "scenes/hour\n---- END RESULTS ----\n",
+         numDone, numScenes, HEIGHT, WIDTH, nFrames, time,
+         elapsed > 0 ? 3600 * numDone / elapsed : 0);
+  if (incrementalRender || adaptiveThreshold >= 0 || useHitBuffer) {
+    printf("Pixels traced: %lld of %lld\n", pixelsTraced, pixelsTotal);
+  }
+
+  return numDone == numScenes ? 0 : -1;
+}
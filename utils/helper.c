@@ -9,6 +9,8 @@
 #include <string.h>
 #include <time.h>
 
+#include "../context.h"
+#include "../memory.h"
 #include "../render.h"
 #include "../simulate.h"
 
@@ -21,16 +23,23 @@ float refImg[3 * WIDTH * HEIGHT];
 // counter for number of frames
 int frameCounter = 0;
 
-void exportFramesRender(sphere *spheres, int numSpheres, vector e, vector u,
-                        vector v, int numLights, light *lights, int nFrames) {
+void exportFramesRender(context *ctx, int nFrames) {
+  vector e = ctx->e, u = ctx->u, v = ctx->v;
+  int numLights = ctx->numLights;
+  light *lights = ctx->lights;
   FILE *fpNew = fopen("framesRenderNew.txt", "w");
   FILE *fpOld = fopen("framesRenderOld.txt", "w");
+  // render() writes in framebufferFormat; compare it expanded to floats
+  void *fb = malloc(framebufferBytes(framebufferFormat, HEIGHT, WIDTH));
   frameCounter = 0;
   while (frameCounter++ < nFrames) {
-    simulateOrig();
-    sort(spheres, numSpheres, e);
-    render((float *)&testImg, HEIGHT, WIDTH, e, u, v, numLights, lights);
-    renderOrig((float *)&refImg, HEIGHT, WIDTH, e, u, v, numLights, lights);
+    simulateOrig(ctx);
+    sort(ctx);
+    render(ctx, fb, HEIGHT, WIDTH, e, u, v, numLights, lights);
+    framebufferToFloat(fb, framebufferFormat, HEIGHT, WIDTH,
+                       (float *)&testImg);
+    renderOrig(ctx, (float *)&refImg, HEIGHT, WIDTH, e, u, v, numLights,
+               lights);
     for (int i = 0; i < 3 * WIDTH * HEIGHT; i++) {
       fprintf(fpNew, "%f ", testImg[i]);
     }
@@ -40,31 +49,36 @@ void exportFramesRender(sphere *spheres, int numSpheres, vector e, vector u,
     }
     fprintf(fpOld, "%f\n", refImg[3 * WIDTH * HEIGHT - 1]);
   }
+  free(fb);
   fclose(fpNew);
   fclose(fpOld);
 }
 
-void exportFramesSimulate(sphere *spheres, int numSpheres, vector e, vector u,
-                          vector v, int numLights, light *lights, int nFrames) {
+void exportFramesSimulate(context *ctx, int nFrames) {
+  sphere *spheres = ctx->spheres;
+  int bodies = ctx->bodies;
+  vector e = ctx->e, u = ctx->u, v = ctx->v;
+  int numLights = ctx->numLights;
+  light *lights = ctx->lights;
   FILE *fpNew = fopen("framesSimNew.txt", "w");
   FILE *fpOld = fopen("framesSimOld.txt", "w");
+  // state before each frame, on the heap since it can be far larger than the
+  // stack
+  size_t bytes = 2 * (size_t)bodies * sizeof(sphere);
+  sphere *spheresOG = (sphere *)bigAlloc(bytes);
+  assert(spheresOG != NULL);
   frameCounter = 0;
   while (frameCounter++ < nFrames) {
-    sphere spheresOG[2 * bodies];
-    sphere spheresCopy[2 * bodies];
-    for (int i = 0; i < 2 * bodies; i++) {
-      spheresOG[i] = copySphere(spheres[i]);
-    }
-    simulate();
-    sort(spheres, numSpheres, e);
-    renderOrig((float *)&testImg, HEIGHT, WIDTH, e, u, v, numLights, lights);
-    for (int i = 0; i < 2 * bodies; i++) {
-      spheresCopy[i] = copySphere(spheres[i]);
-      spheres[i] = copySphere(spheresOG[i]);
-    }
-    simulateOrig();
-    sort(spheres, numSpheres, e);
-    renderOrig((float *)&refImg, HEIGHT, WIDTH, e, u, v, numLights, lights);
+    parallelCopy(spheresOG, spheres, bytes);
+    simulate(ctx);
+    sort(ctx);
+    renderOrig(ctx, (float *)&testImg, HEIGHT, WIDTH, e, u, v, numLights,
+               lights);
+    parallelCopy(spheres, spheresOG, bytes);
+    simulateOrig(ctx);
+    sort(ctx);
+    renderOrig(ctx, (float *)&refImg, HEIGHT, WIDTH, e, u, v, numLights,
+               lights);
     for (int i = 0; i < 3 * WIDTH * HEIGHT; i++) {
       fprintf(fpNew, "%f ", testImg[i]);
     }
@@ -74,6 +88,7 @@ void exportFramesSimulate(sphere *spheres, int numSpheres, vector e, vector u,
     }
     fprintf(fpOld, "%f\n", refImg[3 * WIDTH * HEIGHT - 1]);
   }
+  bigFree(spheresOG);
   fclose(fpNew);
   fclose(fpOld);
 }
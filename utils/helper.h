@@ -5,13 +5,12 @@
 #ifndef HELPER_H
 #define HELPER_H
 
+#include "../context.h"
 #include "../render.h"
 #include "../simulate.h"
 
-void exportFramesRender(sphere *spheres, int numSpheres, vector e, vector u,
-                        vector v, int numLights, light *lights, int nFrames);
+void exportFramesRender(context *ctx, int nFrames);
 
-void exportFramesSimulate(sphere *spheres, int numSpheres, vector e, vector u,
-                          vector v, int numLights, light *lights, int nFrames);
+void exportFramesSimulate(context *ctx, int nFrames);
 
 #endif
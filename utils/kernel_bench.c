@@ -0,0 +1,104 @@
+/**
+ * Benchmark of the render kernels specialized by light count and image size
+ **/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../context.h"
+#include "../memory.h"
+#include "../render.h"
+#include "../simulate.h"
+#include "./fasttime.h"
+
+#define NUM_BODIES 250
+#define NUM_TRIALS 7
+
+static int compareDoubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// deterministic scene with the same extent as the files in simulations/
+static void makeScene(context *ctx, int n) {
+  ctx->bodies = ctx->numSpheres = n;
+  sphere *spheres = (sphere *)bigAlloc(2 * (size_t)n * sizeof(sphere));
+  ctx->spheres = spheres;
+  srand(6172);
+  for (int i = 0; i < n; i++) {
+    sphere s;
+    s.r = 10 + rand() % 10;
+    s.mass = 100 + rand() % 400;
+    s.pos = newVector(rand() % 900 - 450, rand() % 900 - 450,
+                      rand() % 400 - 200);
+    s.vel = newVector(0, 0, 0);
+    s.accel = newVector(0, 0, 0);
+    s.mat = newMaterial(newColor(rand() / (float)RAND_MAX,
+                                 rand() / (float)RAND_MAX,
+                                 rand() / (float)RAND_MAX),
+                        0.5);
+    spheres[i] = s;
+    spheres[i + n] = copySphere(s);
+  }
+}
+
+// median time of render() in ms
+static double timeRender(context *ctx, void *img, int height, int width,
+                         vector e, vector u, vector v, int nLights,
+                         light *lights) {
+  double times[NUM_TRIALS];
+  render(ctx, img, height, width, e, u, v, nLights, lights); // warmup
+  for (int trial = 0; trial < NUM_TRIALS; trial++) {
+    fasttime_t start = gettime();
+    render(ctx, img, height, width, e, u, v, nLights, lights);
+    times[trial] = tdiff_sec(start, gettime()) * 1000;
+  }
+  qsort(times, NUM_TRIALS, sizeof(double), compareDoubles);
+  return times[NUM_TRIALS / 2];
+}
+
+int main(void) {
+  context ctx = {0};
+  makeScene(&ctx, NUM_BODIES);
+
+  // same camera and lights as init()
+  vector e = newVector(800, 100, 0);
+  vector viewDirection = newVector(-1, 0, 0);
+  vector up = newVector(0, 0, 1);
+  vector w = scale(1 / qsize(viewDirection), viewDirection);
+  vector u = scale(1 / qsize(qcross(up, w)), qcross(up, w));
+  vector v = qcross(w, u);
+  ctx.e = e;
+  sort(&ctx);
+
+  light lights[MAX_NUM_LIGHTS];
+  lights[0] = newLight(newVector(0, 240, -100), newColor(1, 1, 1));
+  lights[1] = newLight(newVector(3200, 3000, -1000), newColor(0.6, 0.7, 1));
+  lights[2] = newLight(newVector(600, 0, -100), newColor(0.3, 0.5, 1));
+
+  const int sizes[2][2] = {{HEIGHT, WIDTH}, {512, 512}};
+
+  printf("%d bodies, median of %d trials\n", NUM_BODIES, NUM_TRIALS);
+  printf("lights\tsize\t\tgeneric ms\tspecialized ms\tspeedup\n");
+  for (int s = 0; s < 2; s++) {
+    int height = sizes[s][0], width = sizes[s][1];
+    void *img = framebufferAlloc(framebufferFormat, height, width);
+
+    for (int nLights = 1; nLights <= MAX_NUM_LIGHTS; nLights++) {
+      specializedKernels = 0;
+      double generic =
+          timeRender(&ctx, img, height, width, e, u, v, nLights, lights);
+      specializedKernels = 1;
+      double specialized =
+          timeRender(&ctx, img, height, width, e, u, v, nLights, lights);
+      printf("%d\t%dx%d%s\t%.2f\t\t%.2f\t\t%.3f\n", nLights, height, width,
+             (height == HEIGHT && width == WIDTH) ? " (fixed)" : "\t", generic,
+             specialized, generic / specialized);
+    }
+    framebufferFree(img);
+  }
+
+  freeContext(&ctx);
+  return 0;
+}
@@ -0,0 +1,469 @@
+/**
+ * Microbenchmarks of the simulation and render kernels in isolation
+ **/
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../context.h"
+#include "../framebuffer.h"
+#include "../memory.h"
+#include "../render.h"
+#include "../scene.h"
+#include "../simulate.h"
+#include "./fasttime.h"
+
+#define MAX_SWEEP 16
+#define MIN_TRIAL_MS 2.0 // calls are repeated until a trial takes this long
+#define MAX_REPS 100000
+#define RAY_GRID 64 // the ray kernel traces RAY_GRID^2 rays
+
+// state the kernels run on, for one body count and image size
+typedef struct {
+  context ctx;
+  sphere *shuffled; // spheres in random order, the input of sort()
+  ray rays[RAY_GRID * RAY_GRID];
+  void *img;
+  int height, width;
+  float collisionStep;
+  volatile int sink; // keeps results the compiler could otherwise drop
+} benchState;
+
+typedef struct {
+  const char *name;
+  int usesImage; // swept over image sizes as well as body counts
+  const char *unit;
+  double (*work)(const benchState *b); // units of work per call
+  void (*prepare)(benchState *b);      // untimed, before every call, or NULL
+  void (*run)(benchState *b);
+} kernel;
+
+// statistics of the time per call over the trials of one configuration
+typedef struct {
+  const kernel *k;
+  int bodies, height, width;
+  int trials, reps;
+  double work;
+  double median, p10, p90, min, max, mean, stddev;
+  double ciLow, ciHigh; // 95% confidence interval of the median
+} benchResult;
+
+static double pairWork(const benchState *b) {
+  return (double)b->ctx.bodies * (b->ctx.bodies - 1);
+}
+
+static double halfPairWork(const benchState *b) { return pairWork(b) / 2; }
+
+static double sphereWork(const benchState *b) { return b->ctx.bodies; }
+
+static double rayWork(const benchState *b) {
+  return (double)RAY_GRID * RAY_GRID * b->ctx.bodies;
+}
+
+static double pixelWork(const benchState *b) {
+  return (double)b->height * b->width;
+}
+
+static void runAccelerations(benchState *b) { updateAccelerations(&b->ctx); }
+
+static void runCollisionScan(benchState *b) {
+  int i, j;
+  b->sink = findFirstCollision(&b->ctx, b->collisionStep, &i, &j) > 0;
+}
+
+static void prepareSort(benchState *b) {
+  parallelCopy(b->ctx.spheres, b->shuffled,
+               (size_t)b->ctx.bodies * sizeof(sphere));
+}
+
+static void runSort(benchState *b) { sort(&b->ctx); }
+
+static void runIntersections(benchState *b) {
+  int hits = 0;
+  for (int r = 0; r < RAY_GRID * RAY_GRID; r++) {
+    float t = 20000;
+    for (int i = 0; i < b->ctx.bodies; i++) {
+      hits += rayToSphereIntersection(&b->rays[r], &b->ctx.spheres[i], &t);
+    }
+  }
+  b->sink = hits;
+}
+
+static void runRender(benchState *b) {
+  context *ctx = &b->ctx;
+  render(ctx, b->img, b->height, b->width, ctx->e, ctx->u, ctx->v,
+         ctx->numLights, ctx->lights);
+}
+
+static const kernel kernels[] = {
+    {"updateAccelerations", 0, "pairs", pairWork, NULL, runAccelerations},
+    {"collisionScan", 0, "pairs", halfPairWork, NULL, runCollisionScan},
+    {"sort", 0, "spheres", sphereWork, prepareSort, runSort},
+    {"rayToSphereIntersection", 0, "tests", rayWork, NULL, runIntersections},
+    {"render", 1, "pixels", pixelWork, NULL, runRender},
+};
+
+#define NUM_KERNELS (int)(sizeof(kernels) / sizeof(kernels[0]))
+
+static int compareDoubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// the p-th percentile of sorted[0..n), interpolated between samples
+static double percentile(const double *sorted, int n, double p) {
+  double rank = p / 100 * (n - 1);
+  int lo = (int)rank;
+  if (lo + 1 >= n) {
+    return sorted[n - 1];
+  }
+  return sorted[lo] + (rank - lo) * (sorted[lo + 1] - sorted[lo]);
+}
+
+// ms taken by reps calls of k, not counting prepare
+static double timeCalls(const kernel *k, benchState *b, int reps) {
+  double total = 0;
+  for (int rep = 0; rep < reps; rep++) {
+    if (k->prepare != NULL) {
+      k->prepare(b);
+    }
+    fasttime_t start = gettime();
+    k->run(b);
+    total += tdiff_sec(start, gettime()) * 1000;
+  }
+  return total;
+}
+
+static void measure(const kernel *k, benchState *b, int warmup, int trials,
+                    benchResult *res) {
+  // the warmup calls also decide how many calls make up one trial, so that
+  // trials of fast kernels are long enough for the clock
+  double perCall = 0;
+  for (int w = 0; w < warmup; w++) {
+    perCall = timeCalls(k, b, 1);
+  }
+  if (warmup == 0) {
+    perCall = timeCalls(k, b, 1);
+  }
+  int reps = perCall > 0 ? (int)ceil(MIN_TRIAL_MS / perCall) : MAX_REPS;
+  reps = reps < 1 ? 1 : reps > MAX_REPS ? MAX_REPS : reps;
+
+  double *samples = (double *)malloc(trials * sizeof(double));
+  assert(samples != NULL);
+  double sum = 0;
+  for (int t = 0; t < trials; t++) {
+    samples[t] = timeCalls(k, b, reps) / reps;
+    sum += samples[t];
+  }
+  qsort(samples, trials, sizeof(double), compareDoubles);
+
+  res->k = k;
+  res->bodies = b->ctx.bodies;
+  res->height = k->usesImage ? b->height : 0;
+  res->width = k->usesImage ? b->width : 0;
+  res->trials = trials;
+  res->reps = reps;
+  res->work = k->work(b);
+  res->median = percentile(samples, trials, 50);
+  res->p10 = percentile(samples, trials, 10);
+  res->p90 = percentile(samples, trials, 90);
+  res->min = samples[0];
+  res->max = samples[trials - 1];
+  res->mean = sum / trials;
+  double squares = 0;
+  for (int t = 0; t < trials; t++) {
+    squares += (samples[t] - res->mean) * (samples[t] - res->mean);
+  }
+  res->stddev = trials > 1 ? sqrt(squares / (trials - 1)) : 0;
+
+  // distribution-free interval: the order statistics around the median that
+  // bracket it with 95% probability, by the normal approximation of the
+  // binomial; with few trials it is the whole range
+  double halfWidth = 0.98 * sqrt(trials);
+  int lo = (int)floor(trials / 2.0 - halfWidth) - 1;
+  int hi = (int)ceil(trials / 2.0 + halfWidth);
+  res->ciLow = samples[lo < 0 ? 0 : lo];
+  res->ciHigh = samples[hi > trials - 1 ? trials - 1 : hi];
+  free(samples);
+}
+
+// sets up b for a scene of n bodies; the scene is generated, seeded, so that
+// every run measures the same spheres
+static int setupBodies(benchState *b, int n) {
+  memset(&b->ctx, 0, sizeof(b->ctx));
+  if (generateScene(&b->ctx, n, 6172) != 0) {
+    return -1;
+  }
+  b->shuffled = (sphere *)bigAlloc((size_t)n * sizeof(sphere));
+  assert(b->shuffled != NULL);
+  parallelCopy(b->shuffled, b->ctx.spheres, (size_t)n * sizeof(sphere));
+  srand(6172);
+  for (int i = n - 1; i > 0; i--) {
+    int j = rand() % (i + 1);
+    sphere s = b->shuffled[i];
+    b->shuffled[i] = b->shuffled[j];
+    b->shuffled[j] = s;
+  }
+
+  // a frame as simulate() leaves it: accelerations computed and sorted
+  updateAccelerations(&b->ctx);
+  for (int i = 0; i < n; i++) {
+    b->ctx.spheres[i].accel = b->ctx.spheres[i + n].accel;
+  }
+  sort(&b->ctx);
+  b->collisionStep = simulationStep(&b->ctx);
+
+  for (int y = 0; y < RAY_GRID; y++) {
+    for (int x = 0; x < RAY_GRID; x++) {
+      b->rays[y * RAY_GRID + x] = eyeToPixel(
+          HEIGHT, WIDTH, (x + 0.5f) * WIDTH / RAY_GRID,
+          (y + 0.5f) * HEIGHT / RAY_GRID, b->ctx.e, b->ctx.u, b->ctx.v);
+    }
+  }
+  return 0;
+}
+
+static void freeBodies(benchState *b) {
+  renderReset(&b->ctx);
+  freeContext(&b->ctx);
+  bigFree(b->shuffled);
+}
+
+// parses a comma separated list of at most MAX_SWEEP positive integers, or
+// of HEIGHTxWIDTH sizes when second is not NULL
+// returns the number of entries, or 0 if spec is invalid
+static int parseList(const char *spec, int *first, int *second) {
+  int n = 0;
+  while (n < MAX_SWEEP) {
+    int consumed = 0;
+    if (second != NULL
+            ? sscanf(spec, "%dx%d%n", &first[n], &second[n], &consumed) != 2 ||
+                  second[n] <= 0
+            : sscanf(spec, "%d%n", &first[n], &consumed) != 1) {
+      return 0;
+    }
+    if (first[n] <= 0) {
+      return 0;
+    }
+    n++;
+    spec += consumed;
+    if (*spec == '\0') {
+      return n;
+    }
+    if (*spec++ != ',') {
+      return 0;
+    }
+  }
+  return 0;
+}
+
+static void printResult(const benchResult *r) {
+  char size[32] = "-";
+  if (r->height > 0) {
+    snprintf(size, sizeof(size), "%dx%d", r->height, r->width);
+  }
+  printf("%-24s %8d %10s %11.4f %11.4f %11.4f %11.4f %11.4f %9.3f\n",
+         r->k->name, r->bodies, size, r->median, r->ciLow, r->ciHigh, r->p10,
+         r->p90, r->median * 1e6 / r->work);
+}
+
+static int writeCsv(const char *path, const benchResult *results, int n) {
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) {
+    printf("Could not write %s.\n", path);
+    return -1;
+  }
+  fprintf(fp, "kernel,bodies,height,width,work,unit,trials,reps,median_ms,"
+              "ci95_low_ms,ci95_high_ms,p10_ms,p90_ms,min_ms,max_ms,mean_ms,"
+              "stddev_ms,ns_per_unit\n");
+  for (int i = 0; i < n; i++) {
+    const benchResult *r = &results[i];
+    fprintf(fp, "%s,%d,%d,%d,%.0f,%s,%d,%d,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,"
+                "%.6f,%.6f,%.6f\n",
+            r->k->name, r->bodies, r->height, r->width, r->work, r->k->unit,
+            r->trials, r->reps, r->median, r->ciLow, r->ciHigh, r->p10, r->p90,
+            r->min, r->max, r->mean, r->stddev, r->median * 1e6 / r->work);
+  }
+  int failed = fclose(fp) != 0;
+  if (failed) {
+    printf("Could not write %s.\n", path);
+  }
+  return failed ? -1 : 0;
+}
+
+static int writeJson(const char *path, const benchResult *results, int n,
+                     int warmup, int trials) {
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) {
+    printf("Could not write %s.\n", path);
+    return -1;
+  }
+  fprintf(fp, "{\n  \"warmup\": %d,\n  \"trials\": %d,\n  \"results\": [\n",
+          warmup, trials);
+  for (int i = 0; i < n; i++) {
+    const benchResult *r = &results[i];
+    fprintf(fp,
+            "    {\"kernel\": \"%s\", \"bodies\": %d, \"height\": %d, "
+            "\"width\": %d, \"work\": %.0f, \"unit\": \"%s\", \"trials\": %d, "
+            "\"reps\": %d, \"median_ms\": %.6f, \"ci95_ms\": [%.6f, %.6f], "
+            "\"p10_ms\": %.6f, \"p90_ms\": %.6f, \"min_ms\": %.6f, "
+            "\"max_ms\": %.6f, \"mean_ms\": %.6f, \"stddev_ms\": %.6f, "
+            "\"ns_per_unit\": %.6f}%s\n",
+            r->k->name, r->bodies, r->height, r->width, r->work, r->k->unit,
+            r->trials, r->reps, r->median, r->ciLow, r->ciHigh, r->p10,
+            r->p90, r->min, r->max, r->mean, r->stddev,
+            r->median * 1e6 / r->work, i + 1 < n ? "," : "");
+  }
+  fprintf(fp, "  ]\n}\n");
+  int failed = fclose(fp) != 0;
+  if (failed) {
+    printf("Could not write %s.\n", path);
+  }
+  return failed ? -1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+  int opt;
+  int bodies[MAX_SWEEP] = {250, 1000, 2000};
+  int numBodies = 3;
+  int heights[MAX_SWEEP] = {HEIGHT, 512}, widths[MAX_SWEEP] = {WIDTH, 1024};
+  int numSizes = 2;
+  int warmup = 2, trials = 11;
+  const char *only = NULL;
+  const char *jsonPath = NULL, *csvPath = NULL;
+
+  while ((opt = getopt(argc, argv, "hb:s:w:t:k:j:c:")) != -1) {
+    switch (opt) {
+    case 'b':
+      numBodies = parseList(optarg, bodies, NULL);
+      if (numBodies == 0) {
+        goto help;
+      }
+      break;
+    case 's':
+      numSizes = parseList(optarg, heights, widths);
+      if (numSizes == 0) {
+        goto help;
+      }
+      break;
+    case 'w':
+      warmup = atoi(optarg);
+      if (warmup < 0) {
+        goto help;
+      }
+      break;
+    case 't':
+      trials = atoi(optarg);
+      if (trials <= 0) {
+        goto help;
+      }
+      break;
+    case 'k':
+      only = optarg;
+      break;
+    case 'j':
+      jsonPath = optarg;
+      break;
+    case 'c':
+      csvPath = optarg;
+      break;
+    default:
+      goto help;
+    }
+  }
+  if (optind < argc) {
+    goto help;
+  }
+
+  int numSelected = 0;
+  for (int k = 0; k < NUM_KERNELS; k++) {
+    numSelected += only == NULL || strcmp(only, kernels[k].name) == 0;
+  }
+  if (numSelected == 0) {
+    goto help;
+  }
+
+  benchResult *results = (benchResult *)calloc(
+      (size_t)numSelected * numBodies * numSizes, sizeof(benchResult));
+  assert(results != NULL);
+  int numResults = 0;
+  static benchState b;
+
+  printf("%d warmup calls, median of %d trials of at least %.0f ms\n", warmup,
+         trials, MIN_TRIAL_MS);
+  printf("%-24s %8s %10s %11s %11s %11s %11s %11s %9s\n", "kernel", "bodies",
+         "size", "median ms", "ci95 low", "ci95 high", "p10 ms", "p90 ms",
+         "ns/unit");
+  for (int n = 0; n < numBodies; n++) {
+    if (setupBodies(&b, bodies[n]) != 0) {
+      return 1;
+    }
+    for (int k = 0; k < NUM_KERNELS; k++) {
+      const kernel *kern = &kernels[k];
+      if (only != NULL && strcmp(only, kern->name) != 0) {
+        continue;
+      }
+      for (int s = 0; s < (kern->usesImage ? numSizes : 1); s++) {
+        b.height = heights[s];
+        b.width = widths[s];
+        if (kern->usesImage) {
+          b.img = framebufferAlloc(framebufferFormat, b.height, b.width);
+        }
+        benchResult *r = &results[numResults++];
+        measure(kern, &b, warmup, trials, r);
+        printResult(r);
+        fflush(stdout);
+        if (kern->usesImage) {
+          framebufferFree(b.img);
+          b.img = NULL;
+        }
+      }
+    }
+    freeBodies(&b);
+  }
+
+  int failed = 0;
+  if (csvPath != NULL) {
+    failed |= writeCsv(csvPath, results, numResults) != 0;
+  }
+  if (jsonPath != NULL) {
+    failed |= writeJson(jsonPath, results, numResults, warmup, trials) != 0;
+  }
+  free(results);
+  return failed ? 1 : 0;
+
+help:
+  printf("Usage: ./microbench [-b BODIES,...] [-s HEIGHTxWIDTH,...] [-w N] "
+         "[-t N]\n"
+         "                    [-k KERNEL] [-j PATH] [-c PATH] [-h]\n"
+         "\t"
+         "-b bodies,...             \t Body counts to sweep                  "
+         "\t Optional, default 250,1000,2000\n"
+         "\t"
+         "-s heightxwidth,...       \t Image sizes to sweep for render()     "
+         "\t Optional, default 256x512,512x1024\n"
+         "\t"
+         "-w num-calls              \t Untimed warmup calls per kernel       "
+         "\t Optional, default 2\n"
+         "\t"
+         "-t num-trials             \t Timed trials per kernel               "
+         "\t Optional, default 11\n"
+         "\t"
+         "-k kernel                 \t Runs only this kernel                 "
+         "\t Optional\n"
+         "\t"
+         "-j path                   \t Writes the results as JSON to path    "
+         "\t Optional\n"
+         "\t"
+         "-c path                   \t Writes the results as CSV to path     "
+         "\t Optional\n"
+         "\t"
+         "-h                        \t Displays this help message\n"
+         "Kernels: updateAccelerations, collisionScan, sort, "
+         "rayToSphereIntersection, render\n");
+  return 1;
+}
@@ -12,9 +12,12 @@
 
 #include <signal.h>
 #include <stdbool.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "../main.h"
+#include "../memory.h"
+#include "../scene.h"
 #include "./fasttime.h"
 
 void exitfunc(int sig) {
@@ -22,19 +25,238 @@ void exitfunc(int sig) {
   exit(0);
 }
 
-static uint32_t timed_eval(char *fileName, int N) {
-  init(fileName, N, N);
+#define TIER_FRAMES 3
+
+// Timings of one tier, over its timed runs
+typedef struct {
+  int tier, N, bodies;
+  int passed;
+  int runs;
+  double median_ms, min_ms; // whole runs
+  double simulate_ms, sort_ms, render_ms; // medians of the phases of a run
+  size_t peak_rss; // bytes, while loading and running the tier
+} tier_result;
+
+// Scene and image reused by every run of every tier; they only grow
+typedef struct {
+  context ctx;      // the tier being run, with spheres and img below
+  sphere *initial;  // spheres of the tier as loaded, restored for each run
+  sphere *spheres;
+  size_t sphere_capacity; // of initial and spheres
+  void *img;
+  size_t img_capacity; // bytes
+  uint64_t load_nsec;  // to read the scene file last loaded
+} tier_buffers;
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static double median(double *values, int n) {
+  qsort(values, n, sizeof(double), compare_doubles);
+  return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+// loads the scene in fileName into b to be rendered N x N
+// returns 0 on success, -1 if it cannot be loaded
+static int load_tier(tier_buffers *b, const char *fileName, int N) {
+  context loaded = {0};
+  FILE *fp = fopen(fileName, "r");
+  if (fp == NULL) {
+    return -1;
+  }
+  fasttime_t start = gettime();
+  int status = isBinaryScene(fp) ? mapScene(&loaded, fileName)
+                                 : loadScene(&loaded, fp, fileName);
+  b->load_nsec = tdiff_nsec(start, gettime());
+  fclose(fp);
+  if (status != 0) {
+    return -1;
+  }
+
+  size_t num_spheres = 2 * (size_t)loaded.bodies;
+  if (num_spheres > b->sphere_capacity) {
+    bigFree(b->initial);
+    bigFree(b->spheres);
+    b->initial = (sphere *)bigAlloc(num_spheres * sizeof(sphere));
+    b->spheres = (sphere *)bigAlloc(num_spheres * sizeof(sphere));
+    assert(b->initial != NULL && b->spheres != NULL);
+    b->sphere_capacity = num_spheres;
+  }
+  parallelCopy(b->initial, loaded.spheres, num_spheres * sizeof(sphere));
+
+  size_t img_bytes = framebufferBytes(framebufferFormat, N, N);
+  if (img_bytes > b->img_capacity) {
+    framebufferFree(b->img);
+    b->img = framebufferAlloc(framebufferFormat, N, N);
+    assert(b->img != NULL);
+    b->img_capacity = img_bytes;
+  }
+
+  // the tier takes over the camera and lights of the loaded scene
+  renderReset(&b->ctx);
+  free(b->ctx.lights);
+  context kept = b->ctx;
+  b->ctx = loaded;
+  b->ctx.cache = kept.cache;
+  b->ctx.sortKeys = kept.sortKeys;
+  b->ctx.sortMoved = kept.sortMoved;
+  b->ctx.sortCapacity = kept.sortCapacity;
+  b->ctx.sceneMap = NULL;
+  b->ctx.sceneMapBytes = 0;
+  b->ctx.spheres = b->spheres;
+  b->ctx.img = b->img;
+  b->ctx.height = b->ctx.width = N;
+  loaded.lights = NULL;
+  freeScene(&loaded);
+  return 0;
+}
+
+static void free_tier_buffers(tier_buffers *b) {
+  renderReset(&b->ctx);
+  free(b->ctx.lights);
+  free(b->ctx.sortKeys);
+  free(b->ctx.sortMoved);
+  bigFree(b->initial);
+  bigFree(b->spheres);
+  framebufferFree(b->img);
+  memset(b, 0, sizeof(tier_buffers));
+}
+
+// runs TIER_FRAMES frames of the loaded tier from its initial state
+// returns the total time in ms, and the time of each phase in the others
+static double timed_eval(tier_buffers *b, double *simulate_ms,
+                         double *sort_ms, double *render_ms) {
+  context *ctx = &b->ctx;
+  int N = ctx->height;
+  renderReset(ctx);
+  parallelCopy(ctx->spheres, b->initial,
+               2 * (size_t)ctx->bodies * sizeof(sphere));
+  *simulate_ms = *sort_ms = *render_ms = 0;
+
   fasttime_t start = gettime();
   int currFrames = 0;
-  while (currFrames++ < 3) {
-    simulate();
-    sort(spheres, numSpheres, e);
-    render(img, N, N, e, u, v, numLights, lights);
+  while (currFrames++ < TIER_FRAMES) {
+    fasttime_t frame_start = gettime();
+    simulate(ctx);
+    fasttime_t simulated = gettime();
+    sort(ctx);
+    fasttime_t sorted = gettime();
+    render(ctx, ctx->img, N, N, ctx->e, ctx->u, ctx->v, ctx->numLights,
+           ctx->lights);
+    fasttime_t rendered = gettime();
+    *simulate_ms += tdiff_sec(frame_start, simulated) * 1e3;
+    *sort_ms += tdiff_sec(simulated, sorted) * 1e3;
+    *render_ms += tdiff_sec(sorted, rendered) * 1e3;
   }
-  fasttime_t stop = gettime();
-  free(img);
-  free(spheres);
-  return tdiff_msec(start, stop);
+  return tdiff_sec(start, gettime()) * 1e3;
+}
+
+// loads tier and runs it opts->warmup times untimed, then
+// opts->repetitions times timed, and fills in res
+static void eval_tier(tier_buffers *b, int tier, int N, const char *fileName,
+                      const tierOptions *opts, tier_result *res) {
+  int reps = opts->repetitions;
+  double *runs = (double *)malloc(4 * reps * sizeof(double));
+  assert(runs != NULL);
+  double *simulate_ms = runs + reps, *sort_ms = runs + 2 * reps,
+         *render_ms = runs + 3 * reps;
+
+  resetPeakResident();
+  if (load_tier(b, fileName, N) != 0) {
+    printf("Could not load %s.\n", fileName);
+    exit(1);
+  }
+  for (int w = 0; w < opts->warmup; w++) {
+    double unused[3];
+    timed_eval(b, &unused[0], &unused[1], &unused[2]);
+  }
+  for (int r = 0; r < reps; r++) {
+    runs[r] = timed_eval(b, &simulate_ms[r], &sort_ms[r], &render_ms[r]);
+  }
+
+  res->tier = tier;
+  res->N = N;
+  res->bodies = b->ctx.bodies;
+  res->runs = reps;
+  res->min_ms = runs[0];
+  for (int r = 1; r < reps; r++) {
+    res->min_ms = runs[r] < res->min_ms ? runs[r] : res->min_ms;
+  }
+  res->median_ms = median(runs, reps);
+  res->simulate_ms = median(simulate_ms, reps);
+  res->sort_ms = median(sort_ms, reps);
+  res->render_ms = median(render_ms, reps);
+  res->peak_rss = peakResident();
+  free(runs);
+}
+
+// writes every result so far to path, as JSON if it ends in .json and as
+// CSV otherwise; rewritten after every tier, so that a run cut short by the
+// timeout keeps the tiers it finished
+static void write_tier_results(const char *path, const tier_result *results,
+                               int n, const tierOptions *opts) {
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) {
+    printf("Could not write %s.\n", path);
+    return;
+  }
+  size_t len = strlen(path);
+  int json = len >= 5 && strcmp(path + len - 5, ".json") == 0;
+  if (json) {
+    fprintf(fp,
+            "{\n  \"frames\": %d,\n  \"warmup\": %d,\n  \"repetitions\": "
+            "%d,\n  \"framebuffer\": \"%s\",\n  \"tiers\": [\n",
+            TIER_FRAMES, opts->warmup, opts->repetitions,
+            framebufferFormatName(framebufferFormat));
+  } else {
+    fprintf(fp, "tier,N,bodies,passed,runs,median_ms,min_ms,simulate_ms,"
+                "sort_ms,render_ms,peak_rss_mb\n");
+  }
+  for (int i = 0; i < n; i++) {
+    const tier_result *r = &results[i];
+    if (json) {
+      fprintf(fp,
+              "    {\"tier\": %d, \"N\": %d, \"bodies\": %d, \"passed\": "
+              "%s, \"runs\": %d, \"median_ms\": %.3f, \"min_ms\": %.3f, "
+              "\"simulate_ms\": %.3f, \"sort_ms\": %.3f, \"render_ms\": "
+              "%.3f, \"peak_rss_mb\": %.1f}%s\n",
+              r->tier, r->N, r->bodies, r->passed ? "true" : "false", r->runs,
+              r->median_ms, r->min_ms, r->simulate_ms, r->sort_ms,
+              r->render_ms, r->peak_rss / 1048576.0, i + 1 < n ? "," : "");
+    } else {
+      fprintf(fp, "%d,%d,%d,%d,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.1f\n", r->tier,
+              r->N, r->bodies, r->passed, r->runs, r->median_ms, r->min_ms,
+              r->simulate_ms, r->sort_ms, r->render_ms,
+              r->peak_rss / 1048576.0);
+    }
+  }
+  if (json) {
+    fprintf(fp, "  ]\n}\n");
+  }
+  if (fclose(fp) != 0) {
+    printf("Could not write %s.\n", path);
+  }
+}
+
+// finds the scene of tier, converted to the binary format if available, and
+// writes its name to fileName
+// returns its body count
+static int find_tier_file(int tier, char *fileName, size_t size) {
+  const char *patterns[] = {"tiers/tier%d.scn", "tiers/tier%d.txt",
+                            "/var/6172/tiers/tier%d.scn",
+                            "/var/6172/tiers/tier%d.txt"};
+  double G;
+  long bodies = -1;
+  for (int k = 0; k < 4 && bodies < 0; k++) {
+    snprintf(fileName, size, patterns[k], tier);
+    if (sceneReadHeader(fileName, &G, &bodies) != 0) {
+      bodies = -1;
+    }
+  }
+  assert(bodies >= 0);
+  return (int)bodies;
 }
 
 static void print_pass_message(int tier, int N, int bodies,
@@ -51,6 +273,37 @@ static void print_pass_message(int tier, int N, int bodies,
          random_celebration, tier, N, N, bodies, user_msec);
 }
 
+// framebuffer footprint and the rate at which render() filled it
+static void print_framebuffer_message(int N, double render_ms) {
+  const double bytes = framebufferBytes(framebufferFormat, N, N);
+  const double gb_per_sec =
+      render_ms > 0 ? TIER_FRAMES * bytes / (render_ms * 1e6) : 0;
+  printf("\tFramebuffer %s: %.1f MB, written at %.2f GB/s\n",
+         framebufferFormatName(framebufferFormat), bytes / (1 << 20),
+         gb_per_sec);
+}
+
+// size of the scene file and the rate at which it loaded in load_tier()
+static void print_load_message(const char *fileName, uint64_t load_nsec) {
+  struct stat st;
+  const double bytes = stat(fileName, &st) == 0 ? st.st_size : 0;
+  const double mb_per_sec = load_nsec > 0 ? bytes * 1e3 / load_nsec : 0;
+  printf("\tScene %s: %.2f MB, loaded in %.2f ms at %.0f MB/s\n", fileName,
+         bytes / (1 << 20), load_nsec / 1e6, mb_per_sec);
+}
+
+// where the time of a run went, and the memory the tier took
+static void print_phase_message(const tier_result *res) {
+  if (res->runs > 1) {
+    printf("\tMedian of %d runs, fastest %.0f ms: ", res->runs, res->min_ms);
+  } else {
+    printf("\t");
+  }
+  printf("simulate %.1f ms, sort %.1f ms, render %.1f ms; peak RSS %.1f MB\n",
+         res->simulate_ms, res->sort_ms, res->render_ms,
+         res->peak_rss / 1048576.0);
+}
+
 static void print_tier_pass_message(int tier, int N, int bodies,
                                     uint32_t user_msec) {
   return print_pass_message(tier, N, bodies, user_msec);
@@ -64,17 +317,136 @@ static void print_tier_fail_message(int tier, int N, int bodies,
          tier, N, N, bodies, user_msec, tier_timeout);
 }
 
+// State of a search for the last tier that runs in time
+typedef struct {
+  const tierOptions *opts;
+  uint32_t tier_timeout;
+  const int *img_sizes; // N of every tier
+  tier_buffers buffers;
+  tier_result results[MAX_TIER + 1]; // of the tiers tested, in order
+  int num_results;
+} tier_search;
+
+// runs tier, records its result and reports it
+// returns whether it ran in time
+static bool test_tier(tier_search *s, int tier) {
+  const int N = s->img_sizes[tier];
+  char fileName[100];
+  int bodies = find_tier_file(tier, fileName, sizeof(fileName));
+
+  tier_result *res = &s->results[s->num_results++];
+  eval_tier(&s->buffers, tier, N, fileName, s->opts, res);
+  const uint32_t user_msec = (uint32_t)res->median_ms;
+  res->passed = user_msec < s->tier_timeout;
+  if (s->opts->resultsPath != NULL) {
+    write_tier_results(s->opts->resultsPath, s->results, s->num_results,
+                       s->opts);
+  }
+
+  // Exit if the user time is too much, but was still correct!
+  if (!res->passed) {
+    print_tier_fail_message(tier, N, bodies, user_msec, s->tier_timeout);
+  } else { // Success
+    print_tier_pass_message(tier, N, bodies, user_msec);
+  }
+  print_phase_message(res);
+  print_framebuffer_message(N, res->render_ms);
+  print_load_message(fileName, s->buffers.load_nsec);
+  return res->passed;
+}
+
+// Cost of a tier of B bodies rendered N x N: simulate() checks every pair of
+// bodies and render() every sphere for every pixel
+typedef struct {
+  double ms_per_pair;
+  double ms_per_sample; // sphere per pixel
+  double fixed_ms;      // sort() and the rest
+} tier_model;
+
+// least squares fit of each phase through the origin, over every tier tested
+static void fit_tier_model(const tier_search *s, tier_model *m) {
+  double sim_xy = 0, sim_xx = 0, render_xy = 0, render_xx = 0, rest = 0;
+  for (int i = 0; i < s->num_results; i++) {
+    const tier_result *r = &s->results[i];
+    const double pairs = (double)r->bodies * r->bodies;
+    const double samples = (double)r->bodies * r->N * r->N;
+    sim_xy += pairs * r->simulate_ms;
+    sim_xx += pairs * pairs;
+    render_xy += samples * r->render_ms;
+    render_xx += samples * samples;
+    rest += r->median_ms - r->simulate_ms - r->render_ms;
+  }
+  m->ms_per_pair = sim_xx > 0 ? sim_xy / sim_xx : 0;
+  m->ms_per_sample = render_xx > 0 ? render_xy / render_xx : 0;
+  m->fixed_ms = s->num_results > 0 ? fmax(rest / s->num_results, 0) : 0;
+}
+
+static double predict_tier_ms(const tier_model *m, int bodies, int N) {
+  return m->ms_per_pair * bodies * bodies +
+         m->ms_per_sample * bodies * N * N + m->fixed_ms;
+}
+
+// finds the last tier from start_tier to highest_tier that runs in time by
+// fitting a tier_model to the tiers tested so far and testing the last tier
+// it expects to pass, then the next one; every test narrows the range the
+// answer lies in, and is added to the fit, until the range is one tier
+// returns that tier, or -1 if start_tier fails
+static int model_search(tier_search *s, int start_tier, int highest_tier) {
+  int bodies[MAX_TIER + 1];
+  for (int t = start_tier; t <= highest_tier; t++) {
+    char fileName[100];
+    bodies[t] = find_tier_file(t, fileName, sizeof(fileName));
+  }
+
+  printf(COLOR_YELLOW "Model search from tier %d to %d..." COLOR_DEFAULT "\n",
+         start_tier, highest_tier);
+  if (!test_tier(s, start_tier)) {
+    return -1;
+  }
+  int highest_pass = start_tier;
+  int lowest_fail = highest_tier + 1;
+
+  while (lowest_fail - highest_pass > 1) {
+    tier_model m;
+    fit_tier_model(s, &m);
+    int predicted = highest_pass;
+    while (predicted + 1 < lowest_fail &&
+           predict_tier_ms(&m, bodies[predicted + 1],
+                           s->img_sizes[predicted + 1]) < s->tier_timeout) {
+      predicted++;
+    }
+
+    // confirm the predicted last pass, or else that the tier after the last
+    // pass fails
+    const int tier = predicted > highest_pass ? predicted : highest_pass + 1;
+    printf(COLOR_YELLOW "Model expects tier %d to %s in %.0f ms" COLOR_DEFAULT
+                        "\n",
+           tier, tier == predicted ? "be the last to pass" : "fail",
+           predict_tier_ms(&m, bodies[tier], s->img_sizes[tier]));
+    if (test_tier(s, tier)) {
+      highest_pass = tier;
+    } else {
+      lowest_fail = tier;
+    }
+  }
+  return highest_pass;
+}
+
 uint32_t run_tester_tiers(const uint32_t tier_timeout, const uint32_t timeout,
                           const int start_n, const double increasing_ratio_of_n,
                           const int start_tier, const int highest_tier,
-                          const int linear_tiers, unsigned blowthroughs) {
+                          const int linear_tiers, unsigned blowthroughs,
+                          const tierOptions *opts) {
   // Sanity check the input
   assert(highest_tier <= MAX_TIER);
+  assert(opts->repetitions > 0 && opts->warmup >= 0);
 
   // set timer
   uint32_t MS_TO_SEC = 1000;
-  signal(SIGALRM, exitfunc);
-  alarm((uint32_t)(timeout / MS_TO_SEC));
+  if (!opts->unattended) {
+    signal(SIGALRM, exitfunc);
+    alarm((uint32_t)(timeout / MS_TO_SEC));
+  }
 
   printf("Setting up test up to tier %u: ", highest_tier);
 
@@ -90,6 +462,13 @@ uint32_t run_tester_tiers(const uint32_t tier_timeout, const uint32_t timeout,
     tier_img_sizes[i++] = N;
   }
 
+  // big enough to keep off the stack
+  static tier_search search;
+  memset(&search, 0, sizeof(search));
+  search.opts = opts;
+  search.tier_timeout = tier_timeout;
+  search.img_sizes = tier_img_sizes;
+
   uint32_t tier = start_tier;
   uint32_t linear_tier_cutoff = tier + linear_tiers;
   if (linear_tiers == -1) {
@@ -102,31 +481,17 @@ uint32_t run_tester_tiers(const uint32_t tier_timeout, const uint32_t timeout,
   int highest_pass = -1;
   bool blowthrough_used = false;
 
+  if (opts->modelSearch) {
+    highest_pass = model_search(&search, start_tier, highest_tier);
+    goto finish;
+  }
+
   // Linearly Test up to linear_tier_cutoff
   printf(COLOR_YELLOW "Linear search from tier %d to %d..." COLOR_DEFAULT "\n",
          tier, linear_tier_cutoff);
 
   for (; tier <= linear_tier_cutoff; tier++) {
-    N = tier_img_sizes[tier];
-    char fileName[100];
-    sprintf(fileName, "tiers/tier%d.txt", tier);
-
-    FILE *fp = fopen((char *)&fileName, "r");
-    if (fp == NULL) {
-      sprintf(fileName, "/var/6172/tiers/tier%d.txt", tier);
-      fp = fopen((char *)&fileName, "r");
-    }
-    assert(fp != NULL);
-    int bodies;
-    double G;
-    fscanf(fp, "%lf%d", &G, &bodies);
-    fclose(fp);
-
-    const uint32_t user_msec = timed_eval((char *)&fileName, N);
-
-    // Exit if the user time is too much, but was still correct!
-    if (user_msec >= tier_timeout) {
-      print_tier_fail_message(tier, N, bodies, user_msec, tier_timeout);
+    if (!test_tier(&search, tier)) {
       if (blowthroughs > 0 && tier != linear_tier_cutoff) {
         blowthroughs--;
         blowthrough_used = true;
@@ -138,7 +503,6 @@ uint32_t run_tester_tiers(const uint32_t tier_timeout, const uint32_t timeout,
       }
     } else { // Success
       highest_pass = tier;
-      print_tier_pass_message(tier, N, bodies, user_msec);
     }
   }
 
@@ -163,35 +527,17 @@ uint32_t run_tester_tiers(const uint32_t tier_timeout, const uint32_t timeout,
 
     while (lowest_fail - highest_pass > 1) {
       tier = (lowest_fail + highest_pass) / 2;
-      N = tier_img_sizes[tier];
-      char fileName[100];
-      sprintf(fileName, "tiers/tier%d.txt", tier);
-
-      FILE *fp = fopen((char *)&fileName, "r");
-      if (fp == NULL) {
-        sprintf(fileName, "/var/6172/tiers/tier%d.txt", tier);
-        fp = fopen((char *)&fileName, "r");
-      }
-      assert(fp != NULL);
-      int bodies;
-      double G;
-      fscanf(fp, "%lf%d", &G, &bodies);
-      fclose(fp);
-
-      const uint32_t user_msec = timed_eval((char *)&fileName, N);
-
-      // Exit if the user time is too much, but was still correct!
-      if (user_msec >= tier_timeout) {
-        lowest_fail = tier;
-        print_tier_fail_message(tier, N, bodies, user_msec, tier_timeout);
-      } else { // Success
+      if (test_tier(&search, tier)) {
         highest_pass = tier;
-        print_tier_pass_message(tier, N, bodies, user_msec);
+      } else {
+        lowest_fail = tier;
       }
     }
   }
 
 finish:
+  free_tier_buffers(&search.buffers);
+
   // Print update!
   if (highest_pass >= MAX_TIER + 1) {
     printf(COLOR_GREEN "Congrats! You reached the highest tier we will test "
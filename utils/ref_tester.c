@@ -213,6 +213,8 @@ int main(int argc, char *argv[]) {
     }
 
     cleanup(correct, actual, lineOld, lineNew);
+    // lets scripts such as make check tell a failure apart
+    return max == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
   }
 
   return EXIT_SUCCESS;
@@ -0,0 +1,267 @@
+/**
+ * Command line client of the render daemon (./main -d SOCKET)
+ **/
+
+#include <assert.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../output.h"
+#include "../server.h"
+#include "./fasttime.h"
+
+// returns a socket connected to the daemon listening on path, or -1
+static int connectTo(const char *path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+// reads the whole file at path into a new buffer
+// returns its size, or -1 if it cannot be read
+static long readFile(const char *path, char **text) {
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) {
+    return -1;
+  }
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  *text = (char *)malloc(size > 0 ? size : 1);
+  assert(*text != NULL);
+  if (size <= 0 || fread(*text, 1, size, fp) != (size_t)size) {
+    free(*text);
+    size = -1;
+  }
+  fclose(fp);
+  return size;
+}
+
+// receives the frames of a RENDER reply, writing them to writer if set
+// returns 0 on success, -1 if the reply is cut short or malformed
+static int receiveFrames(FILE *in, asyncWriter *writer, int height, int width,
+                         fbFormat format, FILE *report, uint32_t *msec) {
+  char line[SERVER_MAX_LINE];
+  while (fgets(line, sizeof(line), in) != NULL) {
+    int frame;
+    size_t bytes;
+    unsigned long long simUsec, renderUsec;
+    if (sscanf(line, "DONE %u", msec) == 1) {
+      return 0;
+    }
+    if (sscanf(line, "FRAME %d %zu %llu %llu", &frame, &bytes, &simUsec,
+               &renderUsec) != 4) {
+      break;
+    }
+
+    if (bytes > 0) {
+      if (writer == NULL ||
+          bytes != framebufferBytes(format, height, width)) {
+        break;
+      }
+      void *buf = asyncWriterAcquire(writer);
+      if (fread(buf, 1, bytes, in) != bytes) {
+        break;
+      }
+      writeJob job = {frame, height, width, 0, height, format};
+      asyncWriterSubmit(writer, buf, job);
+    } else {
+      fprintf(report, "Frame %d: simulate %.2f ms, render %.2f ms\n", frame,
+              simUsec / 1e3, renderUsec / 1e3);
+    }
+  }
+  return -1;
+}
+
+int main(int argc, char *argv[]) {
+  int opt;
+  const char *socketPath = NULL;
+  const char *sceneFile = NULL;
+  int sendInline = 0;
+  int numFrames = 10;
+  int height = HEIGHT, width = WIDTH;
+  const char *outputPath = NULL;
+  outFormat outputFormat = OUT_PPM;
+  int stopServer = 0;
+
+  while ((opt = getopt(argc, argv, "hqs:f:i:n:r:o:")) != -1) {
+    switch (opt) {
+    case 's':
+      socketPath = optarg;
+      break;
+    case 'f':
+    case 'i':
+      if (sceneFile != NULL) {
+        goto help;
+      }
+      sceneFile = optarg;
+      sendInline = opt == 'i';
+      break;
+    case 'n':
+      numFrames = atoi(optarg);
+      if (numFrames <= 0) {
+        goto help;
+      }
+      break;
+    case 'r':
+      if (sscanf(optarg, "%dx%d", &height, &width) != 2 || height <= 0 ||
+          width <= 0) {
+        goto help;
+      }
+      break;
+    case 'o':
+      if (!parseOutputSpec(optarg, &outputFormat, &outputPath)) {
+        goto help;
+      }
+      break;
+    case 'q':
+      stopServer = 1;
+      break;
+    default:
+      goto help;
+    }
+  }
+  if (optind < argc || socketPath == NULL ||
+      (sceneFile == NULL) == !stopServer) {
+    goto help;
+  }
+
+  int fd = connectTo(socketPath);
+  if (fd < 0) {
+    printf("Could not connect to %s.\n", socketPath);
+    return 1;
+  }
+  FILE *in = fdopen(fd, "r");
+  FILE *out = fdopen(dup(fd), "w");
+  assert(in != NULL && out != NULL);
+
+  char line[SERVER_MAX_LINE];
+  if (stopServer) {
+    fprintf(out, "SHUTDOWN\n");
+    fflush(out);
+    int ok = fgets(line, sizeof(line), in) != NULL &&
+             strcmp(line, "BYE\n") == 0;
+    fclose(in);
+    fclose(out);
+    return ok ? 0 : 1;
+  }
+
+  fasttime_t start = gettime();
+  const char *reply = outputPath != NULL ? "frames" : "timing";
+  if (sendInline) {
+    char *text;
+    long size = readFile(sceneFile, &text);
+    if (size < 0) {
+      printf("The file name you entered (%s) is invalid.\n", sceneFile);
+      return 1;
+    }
+    fprintf(out, "RENDER %d %d %d %s inline %ld\n", numFrames, height, width,
+            reply, size);
+    fwrite(text, 1, size, out);
+    free(text);
+  } else {
+    // the daemon opens the file itself, from its own working directory
+    char path[PATH_MAX];
+    if (realpath(sceneFile, path) == NULL) {
+      printf("The file name you entered (%s) is invalid.\n", sceneFile);
+      return 1;
+    }
+    fprintf(out, "RENDER %d %d %d %s file %s\n", numFrames, height, width,
+            reply, path);
+  }
+  fflush(out);
+
+  int numSpheres;
+  char formatName[16];
+  fbFormat format;
+  if (fgets(line, sizeof(line), in) == NULL ||
+      sscanf(line, "OK %d %d %d %15s", &numSpheres, &height, &width,
+             formatName) != 4 ||
+      !parseFramebufferFormat(formatName, &format)) {
+    printf("The daemon refused the job: %s", line);
+    return 1;
+  }
+
+  asyncWriter *writer = NULL;
+  if (outputPath != NULL) {
+    writer = asyncWriterOpen(outputPath, 3,
+                             framebufferBytes(format, height, width),
+                             outputEncoder(outputFormat));
+    if (writer == NULL) {
+      return 1;
+    }
+  }
+
+  // keep frames streamed to stdout clean
+  FILE *report = outputPath != NULL && strcmp(outputPath, "-") == 0
+                     ? stderr
+                     : stdout;
+  uint32_t msec = 0;
+  int failed =
+      receiveFrames(in, writer, height, width, format, report, &msec) != 0;
+  if (writer != NULL && asyncWriterClose(writer) != 0) {
+    printf("Writing %s failed.\n", outputPath);
+    failed = 1;
+  }
+  uint32_t roundTrip = tdiff_msec(start, gettime());
+  fclose(in);
+  fclose(out);
+  if (failed) {
+    printf("The daemon hung up before the last frame.\n");
+    return 1;
+  }
+
+  fprintf(report,
+          "Num spheres: %d\nImg size: %dx%d\nNum frames: %d\n---- RESULTS "
+          "----\nTime elapsed: %u ms (daemon), %u ms (round trip)\n---- END "
+          "RESULTS ----\n",
+          numSpheres, height, width, numFrames, msec, roundTrip);
+  return 0;
+
+help:
+  printf(
+      "Usage: ./render_client -s SOCKET (-f FILE_NAME | -i FILE_NAME | -q)\n"
+      "                       [-n NUM_FRAMES] [-r HEIGHTxWIDTH] "
+      "[-o [FORMAT:]PATH] [-h]\n"
+      "\t"
+      "-s socket                 \t Socket of the daemon (./main -d)      \t "
+      "Required\n"
+      "\t"
+      "-f file-name              \t Scene file, opened by the daemon      \t "
+      "Optional, may not be used with -i or -q\n"
+      "\t"
+      "-i file-name              \t Scene file, sent inline               \t "
+      "Optional, may not be used with -f or -q\n"
+      "\t"
+      "-n num-frames             \t Number of frames to execute           \t "
+      "Optional, default 10\n"
+      "\t"
+      "-r heightxwidth           \t Image size (default: 256x512)         \t "
+      "Optional\n"
+      "\t"
+      "-o [ppm|pfm|y4m:]path     \t Writes every frame to path (- stdout) \t "
+      "Optional, prints frame timings when not used\n"
+      "\t"
+      "-q                        \t Shuts the daemon down                 \t "
+      "Optional, may not be used with -f or -i\n"
+      "\t"
+      "-h                        \t This help message\n");
+  return 1;
+}
@@ -0,0 +1,80 @@
+/**
+ * Scaling of scene setup, sort and render to millions of spheres
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../context.h"
+#include "../framebuffer.h"
+#include "../memory.h"
+#include "../render.h"
+#include "../scene.h"
+#include "../simulate.h"
+#include "./fasttime.h"
+
+// largest scene whose O(n^2) time step is still timed
+#define MAX_SIMULATED 20000
+
+int main(int argc, char *argv[]) {
+  long maxBodies = argc > 1 ? atol(argv[1]) : 10000000;
+  if (argc > 2 || maxBodies <= 0 || maxBodies > MAX_BODIES) {
+    printf("Usage: ./scale_bench [MAX_BODIES <= %d]\n", MAX_BODIES);
+    return 1;
+  }
+
+  // every render goes through the BVH, whose cost grows with log n
+  useSceneTree = 1;
+  void *img = framebufferAlloc(framebufferFormat, HEIGHT, WIDTH);
+
+  printf("bodies\t\tneeds MB\tgenerate ms\tsort ms\tresort ms\trender "
+         "ms\tstep ms\n");
+  for (long n = 1000; n <= maxBodies; n *= 10) {
+    size_t needed = contextFootprint(n, HEIGHT, WIDTH, 1);
+    if (needed > availableMemory()) {
+      printf("%ld\t%s%zu\tskipped, only %zu MB are available\n", n,
+             n < 10000000 ? "\t" : "", needed >> 20,
+             availableMemory() >> 20);
+      break;
+    }
+
+    context ctx = {0};
+    fasttime_t start = gettime();
+    if (generateScene(&ctx, (int)n, 6172) != 0) {
+      break;
+    }
+    double generate = tdiff_sec(start, gettime()) * 1000;
+
+    start = gettime();
+    sort(&ctx);
+    double sorted = tdiff_sec(start, gettime()) * 1000;
+
+    // a sort of an already sorted scene, as in every frame after the first
+    start = gettime();
+    sort(&ctx);
+    double resorted = tdiff_sec(start, gettime()) * 1000;
+
+    start = gettime();
+    render(&ctx, img, HEIGHT, WIDTH, ctx.e, ctx.u, ctx.v, ctx.numLights,
+           ctx.lights);
+    double rendered = tdiff_sec(start, gettime()) * 1000;
+
+    printf("%ld\t%s%zu\t\t%.1f\t\t%.1f\t%.1f\t\t%.1f\t", n,
+           n < 10000000 ? "\t" : "", needed >> 20, generate, sorted, resorted,
+           rendered);
+    if (n <= MAX_SIMULATED) {
+      start = gettime();
+      simulate(&ctx);
+      printf("%.1f\n", tdiff_sec(start, gettime()) * 1000);
+    } else {
+      printf("-\n");
+    }
+    fflush(stdout);
+
+    renderReset(&ctx);
+    freeContext(&ctx);
+  }
+
+  framebufferFree(img);
+  return 0;
+}
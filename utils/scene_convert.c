@@ -0,0 +1,35 @@
+/**
+ * Converts a text scene to the binary scene format mapped by ./main
+ **/
+
+#include <stdio.h>
+
+#include "../context.h"
+#include "../scene.h"
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    printf("Usage: ./scene_convert INPUT.txt OUTPUT.scn\n");
+    return 1;
+  }
+
+  FILE *fp = fopen(argv[1], "r");
+  if (fp == NULL) {
+    printf("The file name you entered (%s) is invalid.\n", argv[1]);
+    return 1;
+  }
+  context ctx = {0};
+  int status = loadScene(&ctx, fp, argv[1]);
+  fclose(fp);
+  if (status == 0) {
+    status = saveScene(&ctx, argv[2]);
+    if (status != 0) {
+      printf("Writing %s failed.\n", argv[2]);
+    } else {
+      printf("Wrote %d spheres and %d lights to %s\n", ctx.numSpheres,
+             ctx.numSceneLights, argv[2]);
+    }
+  }
+  freeContext(&ctx);
+  return status == 0 ? 0 : 1;
+}
@@ -0,0 +1,66 @@
+/**
+ * Generates benchmark scenes of any size, as text or binary scenes
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../context.h"
+#include "../scene.h"
+
+// writes the spheres of ctx in the text format loadScene reads
+// returns 0 on success, -1 on failure
+static int writeText(const context *ctx, const char *path) {
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) {
+    printf("Could not write %s.\n", path);
+    return -1;
+  }
+  fprintf(fp, "%g %d\n", ctx->G, ctx->bodies);
+  for (int i = 0; i < ctx->bodies; i++) {
+    const sphere *s = &ctx->spheres[i];
+    fprintf(fp, "%.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n",
+            s->r, s->mass, s->pos.x, s->pos.y, s->pos.z, s->vel.x, s->vel.y,
+            s->vel.z, s->mat.diffuse.red, s->mat.diffuse.green,
+            s->mat.diffuse.blue, s->mat.reflection);
+  }
+  int failed = ferror(fp);
+  failed |= fclose(fp) != 0;
+  if (failed) {
+    printf("Could not write %s.\n", path);
+    return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 3 && argc != 4) {
+    printf("Usage: ./scene_gen BODIES OUTPUT.txt|OUTPUT.scn [SEED]\n");
+    return 1;
+  }
+
+  long bodies = atol(argv[1]);
+  unsigned seed = argc == 4 ? (unsigned)atol(argv[3]) : 6172;
+  if (bodies <= 0 || bodies > MAX_BODIES) {
+    printf("BODIES must be between 1 and %d.\n", MAX_BODIES);
+    return 1;
+  }
+  size_t needed = contextFootprint(bodies, 0, 0, 0);
+  printf("Scene of %ld bodies: about %zu MB to generate\n", bodies,
+         needed >> 20);
+
+  context ctx = {0};
+  if (generateScene(&ctx, (int)bodies, seed) != 0) {
+    return 1;
+  }
+  const char *path = argv[2];
+  size_t len = strlen(path);
+  int binary = len >= 4 && strcmp(path + len - 4, ".scn") == 0;
+  int status = binary ? saveScene(&ctx, path) : writeText(&ctx, path);
+  if (status == 0) {
+    printf("Wrote %d spheres to %s\n", ctx.bodies, path);
+  }
+  freeContext(&ctx);
+  return status == 0 ? 0 : 1;
+}